@@ -10,39 +10,71 @@ AbstractForest::~AbstractForest() {
 /**
  * Return the children nodes.
  */
-std::vector<RoadVertexDesc>& AbstractForest::getChildren(RoadVertexDesc node) {
-	if (!children.contains(node)) {
-		std::vector<RoadVertexDesc> c;
-		children[node] = c;
-	}
+std::vector<RoadVertexDesc> AbstractForest::getChildren(RoadVertexDesc node) const {
+	if (node >= numChildren.size()) return std::vector<RoadVertexDesc>();
+
+	return std::vector<RoadVertexDesc>(childList.begin() + childOffsets[node], childList.begin() + childOffsets[node] + numChildren[node]);
+}
+
+/**
+ * Return the number of the children nodes.
+ */
+int AbstractForest::getNumChildren(RoadVertexDesc node) const {
+	if (node >= numChildren.size()) return 0;
 
-	return children[node];
+	return numChildren[node];
 }
 
 /**
  * Add a child node.
  */
 void AbstractForest::addChild(RoadVertexDesc parent, RoadVertexDesc child) {
-	std::vector<RoadVertexDesc> list = getChildren(parent);
-	list.push_back(child);
-	children[parent] = list;
+	addChildren(parent, std::vector<RoadVertexDesc>(1, child));
 }
 
 /**
- * Return the parents nodes.
+ * Add the children nodes after the existing ones.
+ * The children of the parent are moved to the end of the flat array unless they are already there,
+ * so adding the children of a node one after another does not move them again.
  */
-QList<RoadVertexDesc> AbstractForest::getParent(RoadVertexDesc node) {
-	QList<RoadVertexDesc> ret;
+void AbstractForest::addChildren(RoadVertexDesc parent, const std::vector<RoadVertexDesc>& children) {
+	addNode(parent);
 
-	for (QMap<RoadVertexDesc, std::vector<RoadVertexDesc> >::iterator it = children.begin(); it != children.end(); ++it) {
-		RoadVertexDesc parent = it.key();
-		for (int i = 0; i < children[parent].size(); i++) {
-			if (children[parent][i] == node) {
-				ret.push_back(parent);
-			}
+	int offset = childOffsets[parent];
+	int num = numChildren[parent];
+	if (num == 0) {
+		childOffsets[parent] = childList.size();
+	} else if (offset + num != childList.size()) {
+		childOffsets[parent] = childList.size();
+		for (int i = 0; i < num; i++) {
+			RoadVertexDesc c = childList[offset + i];
+			childList.push_back(c);
 		}
 	}
 
+	for (int i = 0; i < children.size(); i++) {
+		childList.push_back(children[i]);
+		numChildren[parent]++;
+
+		// register the parent to the index
+		addNode(children[i]);
+		parentList.push_back(parent);
+		parentNexts.push_back(parentHeads[children[i]]);
+		parentHeads[children[i]] = parentList.size() - 1;
+	}
+}
+
+/**
+ * Return the parents nodes in the order in which they are added.
+ */
+QList<RoadVertexDesc> AbstractForest::getParent(RoadVertexDesc node) const {
+	QList<RoadVertexDesc> ret;
+	if (node >= parentHeads.size()) return ret;
+
+	for (int i = parentHeads[node]; i >= 0; i = parentNexts[i]) {
+		ret.push_front(parentList[i]);
+	}
+
 	return ret;
 }
 
@@ -52,3 +84,14 @@ QList<RoadVertexDesc> AbstractForest::getParent(RoadVertexDesc node) {
 QList<RoadVertexDesc> AbstractForest::getRoots() {
 	return roots;
 }
+
+/**
+ * Extend the arrays so that they cover the node.
+ */
+void AbstractForest::addNode(RoadVertexDesc node) {
+	if (node < numChildren.size()) return;
+
+	childOffsets.resize(node + 1, 0);
+	numChildren.resize(node + 1, 0);
+	parentHeads.resize(node + 1, -1);
+}
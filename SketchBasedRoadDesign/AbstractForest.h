@@ -4,21 +4,41 @@
 #include <qmap.h>
 #include <vector>
 
+/**
+ * Forest of the vertices of the road graph.
+ * The children of all the nodes are stored in one flat array, in which the children of each node occupy a contiguous range.
+ * The parents of each node are indexed as well, so getParent does not have to scan all the nodes.
+ * Both are indexed by the vertex descriptors, and grow when a new vertex is added to the forest.
+ */
 class AbstractForest {
 public:
 	RoadGraph* roads;
-	QMap<RoadVertexDesc, std::vector<RoadVertexDesc> > children;
 	QList<RoadVertexDesc> roots;
 
+	// the children of the node v are childList[childOffsets[v]] ... childList[childOffsets[v] + numChildren[v] - 1]
+	std::vector<int> childOffsets;
+	std::vector<int> numChildren;
+	std::vector<RoadVertexDesc> childList;
+
+	// the parents of the node v are linked from parentHeads[v] through parentNexts (-1 terminates the list)
+	std::vector<int> parentHeads;
+	std::vector<RoadVertexDesc> parentList;
+	std::vector<int> parentNexts;
+
 public:
 	AbstractForest(RoadGraph* roads);
 	~AbstractForest();
 
-	std::vector<RoadVertexDesc>& getChildren(RoadVertexDesc node);
+	std::vector<RoadVertexDesc> getChildren(RoadVertexDesc node) const;
+	int getNumChildren(RoadVertexDesc node) const;
 	void addChild(RoadVertexDesc parent, RoadVertexDesc child);
-	QList<RoadVertexDesc> getParent(RoadVertexDesc node);
+	void addChildren(RoadVertexDesc parent, const std::vector<RoadVertexDesc>& children);
+	QList<RoadVertexDesc> getParent(RoadVertexDesc node) const;
 	QList<RoadVertexDesc> getRoots();
 
 	virtual void buildForest() = 0;
+
+private:
+	void addNode(RoadVertexDesc node);
 };
 
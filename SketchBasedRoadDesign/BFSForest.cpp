@@ -32,18 +32,18 @@ void BFSForest::buildForest() {
 		RoadEdgeDesc e_desc = GraphUtil::getEdge(roads, src, tgt);
 
 		// Set the group and the seed flag for the edge
-		roads->graph[e_desc]->group = i;
-		roads->graph[e_desc]->seed = true;
+		RoadEdge* edge = roads->detach(e_desc);
+		edge->group = i;
+		edge->seed = true;
 
 		// If the src node is already used as a seed
 		if (seeds.contains(src)) {
 			// copy the src vertex
-			RoadVertex* v = new RoadVertex(roads->graph[src]->pt);
-			RoadVertexDesc new_src = boost::add_vertex(roads->graph);
-			roads->graph[new_src] = v;
+			RoadVertex* v = roads->createVertex(roads->graph[src]->pt);
+			RoadVertexDesc new_src = roads->addVertex(v);
 
 			// remove the old edge
-			roads->graph[e_desc]->valid = false;
+			roads->setValid(e_desc, false);
 
 			// add a new edge
 			e_desc = GraphUtil::addEdge(roads, new_src, tgt, roads->graph[e_desc]);
@@ -54,12 +54,11 @@ void BFSForest::buildForest() {
 		// If the tgt node is already used as a seed
 		if (seeds.contains(tgt)) {
 			// copy the tgt vertex
-			RoadVertex* v = new RoadVertex(roads->graph[tgt]->pt);
-			RoadVertexDesc new_tgt = boost::add_vertex(roads->graph);
-			roads->graph[new_tgt] = v;
+			RoadVertex* v = roads->createVertex(roads->graph[tgt]->pt);
+			RoadVertexDesc new_tgt = roads->addVertex(v);
 
 			// remove the old edge
-			roads->graph[e_desc]->valid = false;
+			roads->setValid(e_desc, false);
 
 			// add a new edge
 			e_desc = GraphUtil::addEdge(roads, src, new_tgt, roads->graph[e_desc]);
@@ -122,7 +121,7 @@ void BFSForest::buildForest() {
 				RoadEdgeDesc orig_e_desc = GraphUtil::getEdge(roads, parent, child);
 
 				// invalidate the original edge
-				roads->graph[orig_e_desc]->valid = false;
+				roads->setValid(orig_e_desc, false);
 
 				// if the node is already visited, copy it and add it as a child.
 				RoadVertexDesc child2 = GraphUtil::addVertex(roads, roads->graph[child]);
@@ -145,6 +144,6 @@ void BFSForest::buildForest() {
 			}
 		}
 
-		this->children.insert(parent, children);
+		addChildren(parent, children);
 	}
 }
\ No newline at end of file
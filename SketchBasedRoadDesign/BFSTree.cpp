@@ -65,7 +65,7 @@ void BFSTree::buildForest() {
 				RoadEdgeDesc orig_e_desc = GraphUtil::getEdge(roads, parent, child);
 
 				// もともとのエッジを無効にする
-				roads->graph[orig_e_desc]->valid = false;
+				roads->setValid(orig_e_desc, false);
 
 				// 対象ノードが訪問済みの場合、対象ノードをコピーして子ノードにする
 				RoadVertexDesc child2 = GraphUtil::addVertex(roads, roads->graph[child]);
@@ -87,6 +87,6 @@ void BFSTree::buildForest() {
 			}
 		}
 
-		this->children.insert(parent, children);
+		addChildren(parent, children);
 	}
 }
\ No newline at end of file
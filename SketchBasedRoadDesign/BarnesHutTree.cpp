@@ -0,0 +1,175 @@
+#include "BarnesHutTree.h"
+#include "BBox.h"
+#include <QtConcurrentMap>
+#include <QThread>
+#include <algorithm>
+#include <math.h>
+
+// the points closer than this depth are merged into one leaf
+#define MAX_DEPTH 32
+
+BarnesHutTree::Node::Node(const QVector2D& center, float halfSize) : center(center), halfSize(halfSize), sum(0, 0), mass(0) {
+	for (int i = 0; i < 4; i++) {
+		children[i] = -1;
+	}
+}
+
+bool BarnesHutTree::Node::isLeaf() const {
+	return children[0] < 0;
+}
+
+bool BarnesHutTree::Node::contains(const QVector2D& p) const {
+	return fabs(p.x() - center.x()) <= halfSize && fabs(p.y() - center.y()) <= halfSize;
+}
+
+/**
+ * @param theta		the opening angle. 0 means no approximation.
+ */
+BarnesHutTree::BarnesHutTree(float theta) : theta(theta) {
+}
+
+BarnesHutTree::~BarnesHutTree() {
+}
+
+/**
+ * Build the tree of the points from scratch.
+ */
+void BarnesHutTree::build(const std::vector<QVector2D>& pts) {
+	nodes.clear();
+	if (pts.size() == 0) return;
+
+	BBox bbox;
+	for (int i = 0; i < pts.size(); i++) {
+		bbox.addPoint(pts[i]);
+	}
+
+	float halfSize = std::max(std::max(bbox.dx(), bbox.dy()) * 0.5f, 1.0f);
+	nodes.push_back(Node(bbox.midPt(), halfSize));
+
+	for (int i = 0; i < pts.size(); i++) {
+		insert(0, pts[i], 0);
+	}
+}
+
+/**
+ * Return the total force from all the points of the tree to the point p.
+ * The point p itself, if it is in the tree, does not contribute to the force.
+ */
+QVector2D BarnesHutTree::computeForce(const QVector2D& p, float restLength) const {
+	QVector2D force(0, 0);
+	if (nodes.size() == 0) return force;
+
+	std::vector<int> stack;
+	stack.push_back(0);
+	while (!stack.empty()) {
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+
+		if (node.mass == 0) continue;
+
+		QVector2D com = node.sum / (float)node.mass;
+		if (node.isLeaf()) {
+			force += computeForce(p, com, restLength) * (float)node.mass;
+			continue;
+		}
+
+		// a distant node is treated as a single point. Since the force is linear in the position
+		// except for its direction, only the sum of the directions is approximated.
+		if (!node.contains(p) && node.halfSize * 2.0f < theta * (com - p).length()) {
+			force += node.sum - p * (float)node.mass - (com - p).normalized() * restLength * (float)node.mass;
+			continue;
+		}
+
+		for (int i = 0; i < 4; i++) {
+			stack.push_back(node.children[i]);
+		}
+	}
+
+	return force;
+}
+
+/**
+ * Return the forces to all the points in the list.
+ * The points are split into blocks, which are processed on all the cores.
+ */
+std::vector<QVector2D> BarnesHutTree::computeForces(const std::vector<QVector2D>& pts, float restLength) const {
+	std::vector<QVector2D> forces(pts.size());
+
+	int numBlocks = std::min((int)pts.size(), QThread::idealThreadCount() * 4);
+	std::vector<Block> blocks(numBlocks);
+	for (int i = 0; i < numBlocks; i++) {
+		blocks[i].tree = this;
+		blocks[i].pts = &pts;
+		blocks[i].forces = &forces;
+		blocks[i].start = pts.size() * i / numBlocks;
+		blocks[i].end = pts.size() * (i + 1) / numBlocks;
+		blocks[i].restLength = restLength;
+	}
+
+	QtConcurrent::blockingMap(blocks, computeForcesInBlock);
+
+	return forces;
+}
+
+/**
+ * Return the force from the point q to the point p.
+ */
+QVector2D BarnesHutTree::computeForce(const QVector2D& p, const QVector2D& q, float restLength) {
+	QVector2D dir = q - p;
+
+	return dir.normalized() * (dir.length() - restLength);
+}
+
+/**
+ * Add the point to the subtree of the node.
+ */
+void BarnesHutTree::insert(int node, const QVector2D& p, int depth) {
+	nodes[node].sum += p;
+	nodes[node].mass++;
+
+	if (!nodes[node].isLeaf()) {
+		insert(getChild(node, p), p, depth + 1);
+		return;
+	}
+
+	if (nodes[node].mass == 1) {
+		nodes[node].pt = p;
+		return;
+	}
+
+	// the same points are kept in one leaf
+	if (p == nodes[node].pt || depth >= MAX_DEPTH) return;
+
+	// split the leaf, and move its points to the child
+	float halfSize = nodes[node].halfSize * 0.5f;
+	for (int i = 0; i < 4; i++) {
+		QVector2D center = nodes[node].center + QVector2D(i % 2 == 0 ? -halfSize : halfSize, i / 2 == 0 ? -halfSize : halfSize);
+		nodes[node].children[i] = nodes.size();
+		nodes.push_back(Node(center, halfSize));
+	}
+
+	int child = getChild(node, nodes[node].pt);
+	nodes[child].mass = nodes[node].mass - 1;
+	nodes[child].sum = nodes[node].pt * (float)nodes[child].mass;
+	nodes[child].pt = nodes[node].pt;
+
+	insert(getChild(node, p), p, depth + 1);
+}
+
+/**
+ * Return the child of the node which covers the point.
+ */
+int BarnesHutTree::getChild(int node, const QVector2D& p) {
+	int index = 0;
+	if (p.x() >= nodes[node].center.x()) index += 1;
+	if (p.y() >= nodes[node].center.y()) index += 2;
+
+	return nodes[node].children[index];
+}
+
+void BarnesHutTree::computeForcesInBlock(Block& block) {
+	for (int i = block.start; i < block.end; i++) {
+		(*block.forces)[i] = block.tree->computeForce((*block.pts)[i], block.restLength);
+	}
+}
+
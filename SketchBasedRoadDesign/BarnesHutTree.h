@@ -0,0 +1,61 @@
+#pragma once
+
+#include <qvector2d.h>
+#include <vector>
+
+/**
+ * Quadtree of points for the Barnes-Hut approximation of the spring forces between all the pairs of the points.
+ * The force from a point q to a point p is (q - p) normalized times (|q - p| - restLength),
+ * so that the points closer than restLength push each other and the farther ones pull each other.
+ * A distant node of the tree is treated as a single point at the center of its points,
+ * if the size of the node divided by the distance is smaller than the opening angle.
+ */
+class BarnesHutTree {
+private:
+	class Node {
+	public:
+		QVector2D center;	// the center of the square of the node
+		float halfSize;		// the half of the width of the square
+		QVector2D sum;		// the sum of the positions of the points under the node
+		int mass;			// the number of the points under the node
+		int children[4];	// the indices of the children (-1 if the node is a leaf)
+		QVector2D pt;		// the position of the points of the leaf
+
+	public:
+		Node(const QVector2D& center, float halfSize);
+		bool isLeaf() const;
+		bool contains(const QVector2D& p) const;
+	};
+
+	/**
+	 * The range of the query points processed by a thread.
+	 */
+	class Block {
+	public:
+		const BarnesHutTree* tree;
+		const std::vector<QVector2D>* pts;
+		std::vector<QVector2D>* forces;
+		int start;
+		int end;
+		float restLength;
+	};
+
+	std::vector<Node> nodes;
+	float theta;
+
+public:
+	BarnesHutTree(float theta = 0.5f);
+	~BarnesHutTree();
+
+	void build(const std::vector<QVector2D>& pts);
+	QVector2D computeForce(const QVector2D& p, float restLength) const;
+	std::vector<QVector2D> computeForces(const std::vector<QVector2D>& pts, float restLength) const;
+
+	static QVector2D computeForce(const QVector2D& p, const QVector2D& q, float restLength);
+
+private:
+	void insert(int node, const QVector2D& p, int depth);
+	int getChild(int node, const QVector2D& p);
+	static void computeForcesInBlock(Block& block);
+};
+
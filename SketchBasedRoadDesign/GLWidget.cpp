@@ -47,13 +47,20 @@ void GLWidget::drawScene() {
 		widthBase = 24.0f;
 	}
 
+	// only the roads visible from the camera are drawn. The margin covers the width of the roads.
+	BBox viewArea;
+	bool culling = getViewArea(widthBase * 4.0f, viewArea);
+
 	// draw the road graph
+	roads->enableSegmentIndex();
 	roads->generateMesh(
 		widthBase,
 		highwayHeight,
 		avenueHeight,
 		(camera->dz < MAX_Z / 4) ? 0.4f : 0.8f,
-		(camera->dz < MAX_Z / 2) ? true : false);
+		(camera->dz < MAX_Z / 2) ? true : false,
+		1.0f,
+		culling ? &viewArea : NULL);
 	renderer->render(roads->renderables);
 
 	// draw the sketch
@@ -62,13 +69,15 @@ void GLWidget::drawScene() {
 
 	// draw the reference road graph
 	if (ref_roads != NULL) {
+		ref_roads->enableSegmentIndex();
 		ref_roads->generateMesh(
 			widthBase,
 			highwayHeight,
 			avenueHeight,
 			(camera->dz < MAX_Z / 4) ? 0.4f : 0.8f,
 			(camera->dz < MAX_Z / 2) ? true : false,
-			0.5f);
+			0.5f,
+			culling ? &viewArea : NULL);
 		renderer->render(ref_roads->renderables);
 
 		// draw the bounding box
@@ -126,15 +135,13 @@ void GLWidget::mousePressEvent(QMouseEvent *event) {
 			RoadVertexDesc v1_desc;
 			if (!GraphUtil::getVertex(sketch, pos, 10.0f, v1_desc)) {
 				// If there is a vertex close to the point, don't add new vertex. Otherwise, add a new vertex.
-				RoadVertex* v1 = new RoadVertex(pos);
-				v1_desc = boost::add_vertex(sketch->graph);
-				sketch->graph[v1_desc] = v1;
+				RoadVertex* v1 = sketch->createVertex(pos);
+				v1_desc = sketch->addVertex(v1);
 			}
 
 			// add the 2nd vertex of a line
-			RoadVertex* v2 = new RoadVertex(pos);
-			RoadVertexDesc v2_desc = boost::add_vertex(sketch->graph);
-			sketch->graph[v2_desc] = v2;
+			RoadVertex* v2 = sketch->createVertex(pos);
+			RoadVertexDesc v2_desc = sketch->addVertex(v2);
 
 			sketch->curVertex = v2_desc;
 
@@ -160,6 +167,9 @@ void GLWidget::mouseReleaseEvent(QMouseEvent *event) {
 			// If there is a vertex close to the point, snap the point to the nearest vertex
 			GraphUtil::snapVertex(sketch, sketch->curVertex, v2_desc);
 		}
+
+		// discard the vertices and edges invalidated by the snapping
+		sketch->clean();
 	}
 
 	event->ignore();
@@ -296,4 +306,43 @@ void GLWidget::mouseTo2D(int x,int y, QVector2D *result) {
 
 	result->setX(posX);
 	result->setY(posY);
+}
+
+/**
+ * Compute the area of the ground (z = 0) visible from the camera.
+ * The rays through the corners of the screen are intersected with the ground.
+ * If any of the rays does not hit the ground (e.g. the camera looks at the horizon), return false.
+ *
+ * @param margin	the area is expanded by this margin
+ */
+bool GLWidget::getViewArea(float margin, BBox& area) {
+	GLint viewport[4];
+	GLdouble modelview[16];
+	GLdouble projection[16];
+
+	// retrieve the matrices
+	glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
+	glGetDoublev(GL_PROJECTION_MATRIX, projection);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	area = BBox();
+	for (int i = 0; i < 4; i++) {
+		GLdouble winX = viewport[0] + ((i % 2 == 0) ? 0 : viewport[2]);
+		GLdouble winY = viewport[1] + ((i / 2 == 0) ? 0 : viewport[3]);
+
+		// unproject the corner on the near plane and the far plane
+		GLdouble nearX, nearY, nearZ, farX, farY, farZ;
+		gluUnProject(winX, winY, 0.0, modelview, projection, viewport, &nearX, &nearY, &nearZ);
+		gluUnProject(winX, winY, 1.0, modelview, projection, viewport, &farX, &farY, &farZ);
+
+		// intersect the ray with the ground
+		if (nearZ <= 0.0 || farZ >= 0.0) return false;
+		double t = nearZ / (nearZ - farZ);
+		area.addPoint(QVector2D(nearX + (farX - nearX) * t, nearY + (farY - nearY) * t));
+	}
+
+	area.minPt -= QVector2D(margin, margin);
+	area.maxPt += QVector2D(margin, margin);
+
+	return true;
 }
\ No newline at end of file
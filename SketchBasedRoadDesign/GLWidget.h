@@ -4,6 +4,7 @@
 #include "RoadGraph.h"
 #include "Sketch.h"
 #include "RoadGraphRenderer.h"
+#include "BBox.h"
 #include <QGLWidget>
 #include <qstring.h>
 #include <qvector3d.h>
@@ -43,5 +44,6 @@ protected:
 
 private:
 	void mouseTo2D(int x, int y, QVector2D *result);
+	bool getViewArea(float margin, BBox& area);
 };
 
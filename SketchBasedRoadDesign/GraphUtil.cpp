@@ -2,9 +2,17 @@
 #include "Util.h"
 #include "Array2D.h"
 #include "BFSForest.h"
+#include "VertexGrid.h"
+#include "SegmentGrid.h"
+#include "BarnesHutTree.h"
+#include "KDTree.h"
+#include "PolyLineView.h"
 #include <qlist.h>
 #include <qmatrix.h>
 #include <qdebug.h>
+#include <QtConcurrentMap>
+#include <QThread>
+#include <set>
 
 #ifndef M_PI
 #define M_PI	3.141592653
@@ -31,6 +39,76 @@ bool EdgePairComparison::operator()(const EdgePair& left, const EdgePair& right)
 	return dissimilarity1 < dissimilarity2;
 }
 
+EdgeCrossing::EdgeCrossing(int edge1, int segment1, float t1, int edge2, int segment2, float t2, const QVector2D& pt) {
+	this->edge1 = edge1;
+	this->segment1 = segment1;
+	this->t1 = t1;
+	this->edge2 = edge2;
+	this->segment2 = segment2;
+	this->t2 = t2;
+	this->pt = pt;
+}
+
+/**
+ * Sort the crossings in the order of the 1st edge, the position along it, and the 2nd edge,
+ * which corresponds to the order in which planarifyOne finds them.
+ */
+bool EdgeCrossing::operator<(const EdgeCrossing& other) const {
+	if (edge1 != other.edge1) return edge1 < other.edge1;
+	if (segment1 != other.segment1) return segment1 < other.segment1;
+	if (t1 != other.t1) return t1 < other.t1;
+	if (edge2 != other.edge2) return edge2 < other.edge2;
+	if (segment2 != other.segment2) return segment2 < other.segment2;
+	return t2 < other.t2;
+}
+
+EdgeCrossingTile::EdgeCrossingTile() {
+	roads = NULL;
+	edges = NULL;
+	segments = NULL;
+	cellSize = 1.0f;
+	originCellX = 0;
+	originCellY = 0;
+	tileCellsX = 1;
+	tileCellsY = 1;
+	numTiles = 1;
+	tileX = 0;
+	tileY = 0;
+}
+
+/**
+ * Return the range of the cells which the bounding box of the segment covers.
+ * The segment is registered to all these cells, so a cell in the overlap of the ranges of two segments has both of them.
+ */
+void EdgeCrossingTile::getCellRange(int segmentId, int& cx0, int& cx1, int& cy0, int& cy1) const {
+	const std::vector<QVector2D>& polyLine = roads->graph[(*edges)[(*segments)[segmentId].first]]->getPolyLine();
+	const QVector2D& p0 = polyLine[(*segments)[segmentId].second];
+	const QVector2D& p1 = polyLine[(*segments)[segmentId].second + 1];
+
+	cx0 = (int)floor(std::min(p0.x(), p1.x()) / cellSize);
+	cx1 = (int)floor(std::max(p0.x(), p1.x()) / cellSize);
+	cy0 = (int)floor(std::min(p0.y(), p1.y()) / cellSize);
+	cy1 = (int)floor(std::max(p0.y(), p1.y()) / cellSize);
+}
+
+/**
+ * Return the column of the tile which contains the column of the cell.
+ * The cells outside the tiles are clamped to the tiles on the border.
+ */
+int EdgeCrossingTile::toTileX(int cx) const {
+	int tx = (int)floor((float)(cx - originCellX) / tileCellsX);
+	return std::min(std::max(tx, 0), numTiles - 1);
+}
+
+/**
+ * Return the row of the tile which contains the row of the cell.
+ * The cells outside the tiles are clamped to the tiles on the border.
+ */
+int EdgeCrossingTile::toTileY(int cy) const {
+	int ty = (int)floor((float)(cy - originCellY) / tileCellsY);
+	return std::min(std::max(ty, 0), numTiles - 1);
+}
+
 /**
  * Return the number of vertices.
  *
@@ -40,32 +118,20 @@ int GraphUtil::getNumVertices(RoadGraph* roads, bool onlyValidVertex) {
 		return boost::num_vertices(roads->graph);
 	}
 
-	int count = 0;
-	RoadVertexIter vi, vend;
-	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
-		if (!roads->graph[*vi]->valid) continue;
-
-		count++;
-	}
-
-	return count;
+	return roads->numValidVertices;
 }
 
 /**
  * Return the number of vertices which are connected to the specified vertex.
  */
 int GraphUtil::getNumConnectedVertices(RoadGraph* roads, RoadVertexDesc start, bool onlyValidVertex) {
-	int count = 1;
-
-	QList<RoadVertexDesc> queue;
+	std::vector<unsigned char> visited(boost::num_vertices(roads->graph), 0);
+	std::vector<RoadVertexDesc> queue;
 	queue.push_back(start);
+	visited[start] = 1;
 
-	QList<RoadVertexDesc> visited;
-	visited.push_back(start);
-
-	while (!queue.empty()) {
-		RoadVertexDesc v = queue.front();
-		queue.pop_front();
+	for (int q = 0; q < queue.size(); q++) {
+		RoadVertexDesc v = queue[q];
 
 		RoadOutEdgeIter ei, eend;
 		for (boost::tie(ei, eend) = boost::out_edges(v, roads->graph); ei != eend; ++ei) {
@@ -74,15 +140,14 @@ int GraphUtil::getNumConnectedVertices(RoadGraph* roads, RoadVertexDesc start, b
 			RoadVertexDesc u = boost::target(*ei, roads->graph);
 			if (onlyValidVertex && !roads->graph[u]->valid) continue;
 
-			if (visited.contains(u)) continue;
+			if (visited[u]) continue;
 
-			visited.push_back(u);
+			visited[u] = 1;
 			queue.push_back(u);
-			count++;
 		}
 	}
 
-	return count;
+	return queue.size();
 }
 
 /**
@@ -104,9 +169,16 @@ RoadVertexDesc GraphUtil::getVertex(RoadGraph* roads, int index, bool onlyValidV
 
 /**
  * Find the closest vertex from the specified point. 
+ * If the spatial index of the vertices is enabled, it is used instead of the linear search.
  */
 RoadVertexDesc GraphUtil::getVertex(RoadGraph* roads, QVector2D pt, bool onlyValidVertex) {
 	RoadVertexDesc nearest_desc;
+
+	if (roads->vertexGrid != NULL) {
+		roads->vertexGrid->findNearest(roads, pt, std::numeric_limits<float>::max(), boost::graph_traits<BGLGraph>::null_vertex(), nearest_desc, onlyValidVertex);
+		return nearest_desc;
+	}
+
 	float min_dist = std::numeric_limits<float>::max();
 
 	RoadVertexIter vi, vend;
@@ -127,8 +199,14 @@ RoadVertexDesc GraphUtil::getVertex(RoadGraph* roads, QVector2D pt, bool onlyVal
 /**
  * Find the closest vertex from the specified point. 
  * If the closet vertex is within the threshold, return true. Otherwise, return false.
+ * If the spatial index of the vertices is enabled, only the vertices within the threshold are searched,
+ * so desc is not updated when false is returned.
  */
 bool GraphUtil::getVertex(RoadGraph* roads, QVector2D pos, float threshold, RoadVertexDesc& desc, bool onlyValidVertex) {
+	if (roads->vertexGrid != NULL) {
+		return roads->vertexGrid->findNearest(roads, pos, threshold, boost::graph_traits<BGLGraph>::null_vertex(), desc, onlyValidVertex);
+	}
+
 	float min_dist = std::numeric_limits<float>::max();
 
 	RoadVertexIter vi, vend;
@@ -147,10 +225,16 @@ bool GraphUtil::getVertex(RoadGraph* roads, QVector2D pos, float threshold, Road
 }
 
 /**
- * Find the closest vertex from the specified point. 
+ * Find the closest vertex from the specified point except the vertex "ignore".
  * If the closet vertex is within the threshold, return true. Otherwise, return false.
+ * If the spatial index of the vertices is enabled, only the vertices within the threshold are searched,
+ * so desc is not updated when false is returned.
  */
 bool GraphUtil::getVertex(RoadGraph* roads, QVector2D pos, float threshold, RoadVertexDesc ignore, RoadVertexDesc& desc, bool onlyValidVertex) {
+	if (roads->vertexGrid != NULL) {
+		return roads->vertexGrid->findNearest(roads, pos, threshold, ignore, desc, onlyValidVertex);
+	}
+
 	float min_dist = std::numeric_limits<float>::max();
 
 	RoadVertexIter vi, vend;
@@ -170,6 +254,53 @@ bool GraphUtil::getVertex(RoadGraph* roads, QVector2D pos, float threshold, Road
 }
 
 
+/**
+ * Return all the vertices within the radius from the specified point in the order of the descriptor.
+ */
+std::vector<RoadVertexDesc> GraphUtil::getVerticesInRadius(RoadGraph* roads, const QVector2D& pos, float radius, bool onlyValidVertex) {
+	if (roads->vertexGrid != NULL) {
+		return roads->vertexGrid->findInRadius(roads, pos, radius, onlyValidVertex);
+	}
+
+	std::vector<RoadVertexDesc> ret;
+
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (onlyValidVertex && !roads->graph[*vi]->valid) continue;
+
+		if ((roads->graph[*vi]->pt - pos).length() <= radius) ret.push_back(*vi);
+	}
+
+	return ret;
+}
+
+/**
+ * Return the k closest vertices from the specified point in the order of the distance.
+ */
+std::vector<RoadVertexDesc> GraphUtil::getNearestVertices(RoadGraph* roads, const QVector2D& pos, int k, bool onlyValidVertex) {
+	if (roads->vertexGrid != NULL) {
+		return roads->vertexGrid->findNearestK(roads, pos, k, onlyValidVertex);
+	}
+
+	std::vector<std::pair<float, RoadVertexDesc> > candidates;
+
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (onlyValidVertex && !roads->graph[*vi]->valid) continue;
+
+		candidates.push_back(std::make_pair((roads->graph[*vi]->pt - pos).length(), *vi));
+	}
+
+	std::sort(candidates.begin(), candidates.end());
+
+	std::vector<RoadVertexDesc> ret;
+	for (int i = 0; i < candidates.size() && i < k; i++) {
+		ret.push_back(candidates[i].second);
+	}
+
+	return ret;
+}
+
 /**
  * 当該頂点が、何番目の頂点かを返却する。
  */
@@ -191,9 +322,8 @@ int GraphUtil::getVertexIndex(RoadGraph* roads, RoadVertexDesc desc, bool onlyVa
  * Add a vertex.
  */
 RoadVertexDesc GraphUtil::addVertex(RoadGraph* roads, RoadVertex* v) {
-	RoadVertex* new_v = new RoadVertex(*v);
-	RoadVertexDesc new_v_desc = boost::add_vertex(roads->graph);
-	roads->graph[new_v_desc] = new_v;
+	RoadVertex* new_v = roads->createVertex(*v);
+	RoadVertexDesc new_v_desc = roads->addVertex(new_v);
 
 	return new_v_desc;
 }
@@ -208,7 +338,7 @@ void GraphUtil::moveVertex(RoadGraph* roads, RoadVertexDesc v, QVector2D pt) {
 	for (boost::tie(ei, eend) = boost::out_edges(v, roads->graph); ei != eend; ++ei) {
 		RoadVertexDesc tgt = boost::target(*ei, roads->graph);
 
-		std::vector<QVector2D> polyLine = roads->graph[*ei]->polyLine;
+		std::vector<QVector2D>& polyLine = roads->detach(*ei)->polyLine;
 		if ((polyLine[0] - roads->graph[v]->getPt()).lengthSquared() < (polyLine[0] - roads->graph[tgt]->getPt()).lengthSquared()) {
 			std::reverse(polyLine.begin(), polyLine.end());
 		}
@@ -219,12 +349,11 @@ void GraphUtil::moveVertex(RoadGraph* roads, RoadVertexDesc v, QVector2D pt) {
 			polyLine[i] += dir * (float)i / (float)(num - 1);
 		}
 		polyLine[num - 1] = pt;
-
-		roads->graph[*ei]->polyLine = polyLine;
+		roads->invalidateGeometry(*ei);
 	}
 
 	// Move the vertex
-	roads->graph[v]->pt = pt;
+	roads->setPt(v, pt);
 }
 
 /**
@@ -233,7 +362,7 @@ void GraphUtil::moveVertex(RoadGraph* roads, RoadVertexDesc v, QVector2D pt) {
 void GraphUtil::collapseVertex(RoadGraph* roads, RoadVertexDesc v1, RoadVertexDesc v2) {
 	if (v1 == v2) return;
 
-	roads->graph[v1]->valid = false;
+	roads->setValid(v1, false);
 
 	RoadOutEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::out_edges(v1, roads->graph); ei != eend; ++ei) {
@@ -243,7 +372,7 @@ void GraphUtil::collapseVertex(RoadGraph* roads, RoadVertexDesc v1, RoadVertexDe
 		RoadVertexDesc v1b = boost::target(*ei, roads->graph);
 
 		// invalidate the edge between v1 and v1b
-		roads->graph[*ei]->valid = false;
+		roads->setValid(*ei, false);
 
 		if (v2 == v1b) continue;
 
@@ -260,17 +389,32 @@ void GraphUtil::collapseVertex(RoadGraph* roads, RoadVertexDesc v1, RoadVertexDe
  */
 int GraphUtil::getDegree(RoadGraph* roads, RoadVertexDesc v, bool onlyValidEdge) {
 	if (onlyValidEdge) {
-		int count = 0;
-		RoadOutEdgeIter ei, eend;
-		for (boost::tie(ei, eend) = boost::out_edges(v, roads->graph); ei != eend; ++ei) {
-			if (roads->graph[*ei]->valid) count++;
-		}
-		return count;
+		return roads->getValidDegree(v);
 	} else {
 		return boost::degree(v, roads->graph);
 	}
 }
 
+/**
+ * Return the list of vertices which have the specified number of valid edges in the order of the descriptors.
+ * For instance, degree = 1 returns all the dead ends.
+ * The vertices are taken from the degree bucket of the graph, so only the vertices of the degree are visited.
+ */
+std::vector<RoadVertexDesc> GraphUtil::getVerticesByDegree(RoadGraph* roads, int degree, bool onlyValidVertex) {
+	const std::vector<RoadVertexDesc>& bucket = roads->getVerticesByDegree(degree);
+
+	std::vector<RoadVertexDesc> ret;
+	ret.reserve(bucket.size());
+	for (int i = 0; i < bucket.size(); i++) {
+		if (onlyValidVertex && !roads->graph[bucket[i]]->valid) continue;
+
+		ret.push_back(bucket[i]);
+	}
+	std::sort(ret.begin(), ret.end());
+
+	return ret;
+}
+
 /**
  * Return the list of vertices.
  */
@@ -296,7 +440,7 @@ void GraphUtil::removeIsolatedVertices(RoadGraph* roads, bool onlyValidVertex) {
 		if (!roads->graph[*vi]->valid) continue;
 
 		if (getDegree(roads, *vi, onlyValidVertex) == 0) {
-			roads->graph[*vi]->valid = false;
+			roads->setValid(*vi, false);
 		}
 	}
 }
@@ -320,11 +464,11 @@ void GraphUtil::snapVertex(RoadGraph* roads, RoadVertexDesc v1, RoadVertexDesc v
 		addEdge(roads, v2, tgt, roads->graph[*ei]);
 
 		// invalidate the old edge
-		roads->graph[*ei]->valid = false;
+		roads->setValid(*ei, false);
 	}
 
 	// invalidate v1
-	roads->graph[v1]->valid = false;
+	roads->setValid(v1, false);
 }
 
 /**
@@ -376,7 +520,7 @@ void GraphUtil::collapseEdge(RoadGraph* roads, RoadEdgeDesc e) {
 	if (v1 == v2) return;
 
 	// invalidate the edge
-	roads->graph[e]->valid = false;
+	roads->setValid(e, false);
 
 	if (getDegree(roads, v1) < getDegree(roads, v2)) {
 		snapVertex(roads, v1, v2);
@@ -389,14 +533,18 @@ void GraphUtil::collapseEdge(RoadGraph* roads, RoadEdgeDesc e) {
  * Return the number of edges.
  */
 int GraphUtil::getNumEdges(RoadGraph* roads, bool onlyValidEdge) {
-	int count = 0;
-
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
-		if (roads->graph[*ei]->valid) count++;
+	if (!onlyValidEdge) {
+		return boost::num_edges(roads->graph);
 	}
 
-	return count;
+	return roads->numValidEdges;
+}
+
+/**
+ * Return the number of valid edges of the specified type.
+ */
+int GraphUtil::getNumEdgesByType(RoadGraph* roads, unsigned int type) {
+	return roads->numValidEdgesByType.value(type, 0);
 }
 
 /**
@@ -407,21 +555,20 @@ RoadEdgeDesc GraphUtil::addEdge(RoadGraph* roads, RoadVertexDesc src, RoadVertex
 	if (hasEdge(roads, src, tgt, false)) {
 		// 既にエッジがある場合は、それを更新する
 		RoadEdgeDesc edge_desc = getEdge(roads, src, tgt, false);
-		roads->graph[edge_desc]->polyLine.clear();
-		roads->graph[edge_desc]->addPoint(roads->graph[src]->getPt());
-		roads->graph[edge_desc]->addPoint(roads->graph[tgt]->getPt());
+		RoadEdge* edge = roads->detach(edge_desc);
+		edge->polyLine.clear();
+		edge->addPoint(roads->graph[src]->getPt());
+		edge->addPoint(roads->graph[tgt]->getPt());
+		roads->invalidateGeometry(edge_desc);
 
 		return edge_desc;
 	} else {
 		// エッジがない場合は、エッジを新規追加する
-		RoadEdge* e = new RoadEdge(lanes, type, oneWay);
+		RoadEdge* e = roads->createEdge(lanes, type, oneWay);
 		e->addPoint(roads->graph[src]->getPt());
 		e->addPoint(roads->graph[tgt]->getPt());
 
-		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, roads->graph);
-		roads->graph[edge_pair.first] = e;
-
-		return edge_pair.first;
+		return roads->addEdge(src, tgt, e);
 	}
 }
 
@@ -433,19 +580,24 @@ RoadEdgeDesc GraphUtil::addEdge(RoadGraph* roads, RoadVertexDesc src, RoadVertex
 	if (hasEdge(roads, src, tgt, false)) {
 		// If there is an edge, update it instead of creating another one.
 		RoadEdgeDesc edge_desc = getEdge(roads, src, tgt, false);
-		*roads->graph[edge_desc] = *ref_edge;
-		roads->graph[edge_desc]->valid = true;
+
+		// invalidate it once so that the counts of the old type are updated
+		roads->setValid(edge_desc, false);
+
+		RoadEdge* edge = roads->detach(edge_desc);
+		int handle = edge->handle;
+		*edge = *ref_edge;
+		edge->handle = handle;
+		edge->valid = false;
+		roads->setValid(edge_desc, true);
 
 		return edge_desc;
 	} else {
 		// If there is no edge, add an edge.
-		RoadEdge* e = new RoadEdge(*ref_edge);
+		RoadEdge* e = roads->createEdge(*ref_edge);
 		e->valid = true;
 
-		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, roads->graph);
-		roads->graph[edge_pair.first] = e;
-
-		return edge_pair.first;
+		return roads->addEdge(src, tgt, e);
 	}
 }
 
@@ -453,6 +605,11 @@ RoadEdgeDesc GraphUtil::addEdge(RoadGraph* roads, RoadVertexDesc src, RoadVertex
  * Check if there is an edge between two vertices.
  */
 bool GraphUtil::hasEdge(RoadGraph* roads, RoadVertexDesc desc1, RoadVertexDesc desc2, bool onlyValidEdge) {
+	// use the adjacency index if available
+	if (onlyValidEdge && roads->adjacencyIndex != NULL) {
+		return roads->adjacencyIndex->contains(RoadGraph::adjacencyKey(desc1, desc2));
+	}
+
 	RoadOutEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::out_edges(desc1, roads->graph); ei != eend; ++ei) {
 		if (onlyValidEdge && !roads->graph[*ei]->valid) continue;
@@ -475,6 +632,14 @@ bool GraphUtil::hasEdge(RoadGraph* roads, RoadVertexDesc desc1, RoadVertexDesc d
  * Return the edge between src and tgt.
  */
 RoadEdgeDesc GraphUtil::getEdge(RoadGraph* roads, RoadVertexDesc src, RoadVertexDesc tgt, bool onlyValidEdge) {
+	// use the adjacency index if available.
+	// If there are parallel edges, the index doesn't keep their order, so the first one is found by scanning the out edges below.
+	if (onlyValidEdge && roads->adjacencyIndex != NULL) {
+		int count = roads->adjacencyIndex->count(RoadGraph::adjacencyKey(src, tgt));
+		if (count == 0) throw "No edge found.";
+		if (count == 1) return roads->adjacencyIndex->value(RoadGraph::adjacencyKey(src, tgt));
+	}
+
 	RoadOutEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::out_edges(src, roads->graph); ei != eend; ++ei) {
 		if (onlyValidEdge && !roads->graph[*ei]->valid) continue;
@@ -495,15 +660,14 @@ RoadEdgeDesc GraphUtil::getEdge(RoadGraph* roads, RoadVertexDesc src, RoadVertex
  * Sort the points of the polyline of the edge in such a way that the first point is the location of the src vertex.
  */
 std::vector<QVector2D> GraphUtil::getOrderedPolyLine(RoadGraph* roads, RoadEdgeDesc e) {
-	std::vector<QVector2D> ret = roads->graph[e]->getPolyLine();
+	const std::vector<QVector2D>& polyLine = roads->graph[e]->getPolyLine();
 
 	RoadVertexDesc src = boost::source(e, roads->graph);
 	RoadVertexDesc tgt = boost::target(e, roads->graph);
-	if ((roads->graph[src]->getPt() - roads->graph[e]->getPolyLine()[0]).length() < (roads->graph[tgt]->getPt() - roads->graph[e]->getPolyLine()[0]).length()) {
-		return ret;
+	if ((roads->graph[src]->getPt() - polyLine[0]).length() < (roads->graph[tgt]->getPt() - polyLine[0]).length()) {
+		return polyLine;
 	} else {
-		std::reverse(ret.begin(), ret.end());
-		return ret;
+		return std::vector<QVector2D>(polyLine.rbegin(), polyLine.rend());
 	}
 }
 
@@ -523,8 +687,11 @@ void GraphUtil::orderPolyLine(RoadGraph* roads, RoadEdgeDesc e, RoadVertexDesc s
 	}
 
 	// If the order is opposite, reverse the order.
-	if ((roads->graph[src]->getPt() - roads->graph[e]->getPolyLine()[0]).length() > (roads->graph[tgt]->getPt() - roads->graph[e]->getPolyLine()[0]).length()) {
-		std::reverse(roads->graph[e]->polyLine.begin(), roads->graph[e]->polyLine.end());
+	// Note: Reversing the points changes neither the length nor the bounding box, so the cache of the edge is kept.
+	const QVector2D& pt0 = roads->graph[e]->polyLine[0];
+	if ((roads->graph[src]->getPt() - pt0).length() > (roads->graph[tgt]->getPt() - pt0).length()) {
+		std::vector<QVector2D>& polyLine = roads->detach(e)->polyLine;
+		std::reverse(polyLine.begin(), polyLine.end());
 	}
 }
 
@@ -538,55 +705,106 @@ void GraphUtil::moveEdge(RoadGraph* roads, RoadEdgeDesc e, QVector2D& src_pos, Q
 	QVector2D src_diff = src_pos - roads->graph[src]->pt;
 	QVector2D tgt_diff = tgt_pos - roads->graph[tgt]->pt;
 
-	if ((roads->graph[e]->polyLine[0] - roads->graph[src]->pt).length() < (roads->graph[e]->polyLine[0] - roads->graph[tgt]->pt).length()) {
-		int n = roads->graph[e]->polyLine.size();
+	std::vector<QVector2D>& polyLine = roads->detach(e)->polyLine;
+	if ((polyLine[0] - roads->graph[src]->pt).length() < (polyLine[0] - roads->graph[tgt]->pt).length()) {
+		int n = polyLine.size();
 		for (int i = 1; i < n - 1; i++) {
-			roads->graph[e]->polyLine[i] += src_diff + (tgt_diff - src_diff) * (float)i / (float)(n - 1);
+			polyLine[i] += src_diff + (tgt_diff - src_diff) * (float)i / (float)(n - 1);
 		}
-		roads->graph[e]->polyLine[0] = src_pos;
-		roads->graph[e]->polyLine[n - 1] = tgt_pos;
+		polyLine[0] = src_pos;
+		polyLine[n - 1] = tgt_pos;
+		roads->invalidateGeometry(e);
 	} else {
-		int n = roads->graph[e]->polyLine.size();
+		int n = polyLine.size();
 		for (int i = 1; i < n - 1; i++) {
-			roads->graph[e]->polyLine[i] += tgt_diff + (src_diff - tgt_diff) * (float)i / (float)(n - 1);
+			polyLine[i] += tgt_diff + (src_diff - tgt_diff) * (float)i / (float)(n - 1);
 		}
-		roads->graph[e]->polyLine[0] = tgt_pos;
-		roads->graph[e]->polyLine[n - 1] = src_pos;
+		polyLine[0] = tgt_pos;
+		polyLine[n - 1] = src_pos;
+		roads->invalidateGeometry(e);
 	}
 }
 
 /**
- * Remove all the dead-end edges.
+ * Remove all the dead-end edges repeatedly until no dead end is left, i.e., only the 2-core of the graph is kept.
+ * The vertices which become isolated are removed as well, while the vertices isolated from the beginning are kept.
+ * Return the list of the removed vertices.
  */
-bool GraphUtil::removeDeadEnd(RoadGraph* roads) {
-	bool removed = false;
+std::vector<RoadVertexDesc> GraphUtil::removeDeadEnd(RoadGraph* roads) {
+	std::vector<RoadVertexDesc> removed;
 
-	bool removedOne = true;
-	while (removedOne) {
-		removedOne = false;
-		RoadVertexIter vi, vend;
-		for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
-			if (!roads->graph[*vi]->valid) continue;
+	std::vector<bool> core = getTwoCore(roads);
 
-			if (getDegree(roads, *vi) == 1) {
-				// invalidate all the outing edges.
-				RoadOutEdgeIter ei, eend;
-				for (boost::tie(ei, eend) = boost::out_edges(*vi, roads->graph); ei != eend; ++ei) {
-					roads->graph[*ei]->valid = false;
-				}
+	// the degrees before any edge is invalidated, so that the result does not depend on the order of the vertices
+	std::vector<int> degrees(boost::num_vertices(roads->graph), 0);
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (!roads->graph[*vi]->valid) continue;
 
-				// invalidate the vertex as well.
-				roads->graph[*vi]->valid = false;
+		degrees[*vi] = getDegree(roads, *vi);
+	}
 
-				removedOne = true;
-				removed = true;
-			}
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (!roads->graph[*vi]->valid) continue;
+		if (core[*vi] || degrees[*vi] == 0) continue;
+
+		// invalidate all the outing edges.
+		RoadOutEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::out_edges(*vi, roads->graph); ei != eend; ++ei) {
+			roads->setValid(*ei, false);
 		}
+
+		// invalidate the vertex as well.
+		roads->setValid(*vi, false);
+
+		removed.push_back(*vi);
 	}
 
 	return removed;
 }
 
+/**
+ * Return whether each vertex belongs to the 2-core of the graph, i.e., whether it remains after the dead ends are removed repeatedly.
+ * The vertices whose degrees are less than 2 are peeled off through a queue, and their neighbors are queued
+ * when their degrees drop below 2, so that each vertex and edge is visited only once.
+ * The result is indexed by the vertex descriptors. The invalid vertices do not belong to the 2-core.
+ */
+std::vector<bool> GraphUtil::getTwoCore(RoadGraph* roads) {
+	std::vector<bool> core(boost::num_vertices(roads->graph), false);
+	std::vector<int> degrees(boost::num_vertices(roads->graph), 0);
+	std::vector<RoadVertexDesc> queue;
+
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (!roads->graph[*vi]->valid) continue;
+
+		degrees[*vi] = getDegree(roads, *vi);
+		if (degrees[*vi] >= 2) {
+			core[*vi] = true;
+		} else {
+			queue.push_back(*vi);
+		}
+	}
+
+	for (int i = 0; i < queue.size(); i++) {
+		RoadOutEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::out_edges(queue[i], roads->graph); ei != eend; ++ei) {
+			if (!roads->graph[*ei]->valid) continue;
+
+			// the neighbor which is already peeled off is skipped
+			RoadVertexDesc tgt = boost::target(*ei, roads->graph);
+			if (!core[tgt]) continue;
+
+			if (--degrees[tgt] < 2) {
+				core[tgt] = false;
+				queue.push_back(tgt);
+			}
+		}
+	}
+
+	return core;
+}
+
 /**
  * Interpolate two polylines.
  * If the number of nodes are same, just interpolate them one by one.
@@ -597,8 +815,8 @@ std::vector<QVector2D> GraphUtil::interpolateEdges(RoadGraph* roads1, RoadEdgeDe
 	orderPolyLine(roads1, e1, src1);
 	orderPolyLine(roads2, e2, src2);
 
-	std::vector<QVector2D> polyLine1 = roads1->graph[e1]->polyLine;
-	std::vector<QVector2D> polyLine2 = roads2->graph[e2]->polyLine;
+	const std::vector<QVector2D>& polyLine1 = roads1->graph[e1]->getPolyLine();
+	const std::vector<QVector2D>& polyLine2 = roads2->graph[e2]->getPolyLine();
 
 	std::vector<QVector2D> ret;
 
@@ -662,7 +880,7 @@ void GraphUtil::computeImportanceOfEdges(RoadGraph* roads, float w_length, float
 		RoadVertexDesc src = boost::source(*ei, roads->graph);
 		RoadVertexDesc tgt = boost::target(*ei, roads->graph);
 
-		roads->graph[*ei]->importance = roads->graph[*ei]->getLength() / max_length * w_length + (getDegree(roads, src) + getDegree(roads, tgt)) * w_valence + roads->graph[*ei]->lanes * w_lanes;
+		roads->detach(*ei)->importance = roads->graph[*ei]->getLength() / max_length * w_length + (getDegree(roads, src) + getDegree(roads, tgt)) * w_valence + roads->graph[*ei]->lanes * w_lanes;
 	}
 }
 
@@ -710,9 +928,9 @@ void GraphUtil::removeIsolatedEdges(RoadGraph* roads, bool onlyValidEdge) {
 		RoadVertexDesc tgt = boost::target(*ei, roads->graph);
 
 		if (getDegree(roads, src, onlyValidEdge) == 1 && getDegree(roads, tgt, onlyValidEdge) == 1) {
-			roads->graph[*ei]->valid = false;
-			roads->graph[src]->valid = false;
-			roads->graph[tgt]->valid = false;
+			roads->setValid(*ei, false);
+			roads->setValid(src, false);
+			roads->setValid(tgt, false);
 		}
 	}
 }
@@ -728,10 +946,9 @@ RoadGraph* GraphUtil::copyRoads(RoadGraph* roads) {
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
 		// Add a vertex
-		RoadVertex* new_v = new RoadVertex(roads->graph[*vi]->getPt());
+		RoadVertex* new_v = new_roads->createVertex(roads->graph[*vi]->getPt());
 		new_v->valid = roads->graph[*vi]->valid;
-		RoadVertexDesc new_v_desc = boost::add_vertex(new_roads->graph);
-		new_roads->graph[new_v_desc] = new_v;	
+		RoadVertexDesc new_v_desc = new_roads->addVertex(new_v);
 
 		conv[*vi] = new_v_desc;
 	}
@@ -745,14 +962,35 @@ RoadGraph* GraphUtil::copyRoads(RoadGraph* roads) {
 		RoadVertexDesc new_tgt = conv[tgt];
 
 		// Add an edge
-		RoadEdge* new_e = new RoadEdge(*roads->graph[*ei]);
-		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(new_src, new_tgt, new_roads->graph);
-		new_roads->graph[edge_pair.first] = new_e;
+		RoadEdge* new_e = new_roads->createEdge(*roads->graph[*ei]);
+		new_roads->addEdge(new_src, new_tgt, new_e);
 	}
 
 	return new_roads;
 }
 
+/**
+ * Create a copy-on-write snapshot of the road graph.
+ * Only the adjacency structure is copied, and the vertex and edge objects are shared with the original graph.
+ * An object is copied when it is modified through RoadGraph::detach, RoadGraph::setValid, or the matching functions
+ * (findCorrespondence, forceMatching), so the original graph is never affected.
+ * Note: The original graph has to outlive the snapshot. Use copyRoads to edit the graph in other ways.
+ */
+RoadGraph* GraphUtil::createSnapshot(RoadGraph* roads) {
+	RoadGraph* snapshot = new RoadGraph();
+	snapshot->graph = roads->graph;
+	snapshot->shared = true;
+
+	snapshot->validDegrees = roads->validDegrees;
+	snapshot->degreeBuckets = roads->degreeBuckets;
+	snapshot->degreeBucketPositions = roads->degreeBucketPositions;
+	snapshot->numValidVertices = roads->numValidVertices;
+	snapshot->numValidEdges = roads->numValidEdges;
+	snapshot->numValidEdgesByType = roads->numValidEdgesByType;
+
+	return snapshot;
+}
+
 /**
  * Copy the road graph.
  * Note: This function copies all the vertices and edges including the invalid ones. Thus, their IDs will be preserved.
@@ -764,10 +1002,9 @@ void GraphUtil::copyRoads(RoadGraph* roads1, RoadGraph* roads2) {
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads1->graph); vi != vend; ++vi) {
 		// Add a vertex
-		RoadVertex* new_v = new RoadVertex(roads1->graph[*vi]->getPt());
+		RoadVertex* new_v = roads2->createVertex(roads1->graph[*vi]->getPt());
 		new_v->valid = roads1->graph[*vi]->valid;
-		RoadVertexDesc new_v_desc = boost::add_vertex(roads2->graph);
-		roads2->graph[new_v_desc] = new_v;
+		RoadVertexDesc new_v_desc = roads2->addVertex(new_v);
 
 		conv[*vi] = new_v_desc;
 	}
@@ -781,9 +1018,8 @@ void GraphUtil::copyRoads(RoadGraph* roads1, RoadGraph* roads2) {
 		RoadVertexDesc new_tgt = conv[tgt];
 
 		// Add an edge
-		RoadEdge* new_e = new RoadEdge(*roads1->graph[*ei]);
-		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(new_src, new_tgt, roads2->graph);
-		roads2->graph[edge_pair.first] = new_e;
+		RoadEdge* new_e = roads2->createEdge(*roads1->graph[*ei]);
+		roads2->addEdge(new_src, new_tgt, new_e);
 	}
 }
 
@@ -796,9 +1032,8 @@ void GraphUtil::mergeRoads(RoadGraph* roads1, RoadGraph* roads2) {
 	// copy vertices from the 2nd road to the 1st road
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads2->graph); vi != vend; ++vi) {
-		RoadVertex* v1 = new RoadVertex(*roads2->graph[*vi]);
-		RoadVertexDesc v1_desc = boost::add_vertex(roads1->graph);
-		roads1->graph[v1_desc] = v1;
+		RoadVertex* v1 = roads1->createVertex(*roads2->graph[*vi]);
+		RoadVertexDesc v1_desc = roads1->addVertex(v1);
 
 		conv[*vi] = v1_desc;
 	}
@@ -816,7 +1051,7 @@ void GraphUtil::mergeRoads(RoadGraph* roads1, RoadGraph* roads2) {
 	}
 
 	// make the result to be a planer graph
-	//planarify(roads1);	// temporarily comment out because this takes too much time
+	planarify(roads1, true);
 }
 
 /**
@@ -839,29 +1074,112 @@ BBox GraphUtil::getAABoundingBox(RoadGraph* roads) {
  * Return the bounding box of the road graph.
  * 
  * The bounding box is not necessarily aligned to X/Y-axis.
- * Algorithm: Rotate the road graph from -90 degree to 90 degree by 5 degree per step, compute the axix aligned bounding box, and find the minimum one in terms of its area.
+ * Algorithm: Among the angles from theta1 to theta2, find the one that minimizes the area of the axis aligned bounding box
+ * of the rotated road graph by getMinAreaBoundingBox.
  * The raod graph is updated to be rotated based on the bounding box in the end.
+ *
+ * @param theta_step	not used any more since the exact angle is computed
  */
 BBox GraphUtil::getBoudingBox(RoadGraph* roads, float theta1, float theta2, float theta_step) {
-	float min_area = std::numeric_limits<float>::max();
-	float min_theta;
-	BBox min_box;
+	std::vector<QVector2D> pts;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (!roads->graph[*vi]->valid) continue;
+
+		pts.push_back(roads->graph[*vi]->pt);
+	}
+
+	float theta;
+	BBox box = getMinAreaBoundingBox(Util::convexHull(pts), theta1, theta2, theta);
+
+	rotate(roads, theta);
+	return box;
+}
+
+/**
+ * Return the minimum-area bounding box of the road graph without rotating the road graph.
+ * The box is the axis aligned bounding box of the road graph rotated by theta (see rotate).
+ */
+BBox GraphUtil::getBoudingBox(RoadGraph* roads, float& theta) {
+	std::vector<QVector2D> pts;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (!roads->graph[*vi]->valid) continue;
+
+		pts.push_back(roads->graph[*vi]->pt);
+	}
 
-	for (float theta = theta1; theta <= theta2; theta += theta_step) {
-		RoadGraph* rotated_roads = copyRoads(roads);
-		rotate(rotated_roads, theta);
-		BBox box = getAABoundingBox(rotated_roads);
-		if (box.dx() * box.dy() < min_area) {
-			min_area = box.dx() * box.dy();
-			min_theta = theta;
-			min_box = box;
+	return getMinAreaBoundingBox(Util::convexHull(pts), -M_PI * 0.5f, M_PI * 0.5f, theta);
+}
+
+/**
+ * Find the angle between theta1 and theta2 that minimizes the area of the axis aligned bounding box of the convex hull rotated by the angle.
+ * The minimum-area rectangle has a side collinear with an edge of the convex hull, so only such angles and both ends of the range
+ * have to be checked. The rectangles for the edges are found by rotating calipers in O(n).
+ *
+ * @param hull		the convex hull in the counterclockwise order (see Util::convexHull)
+ * @param theta		the angle of the rotation
+ * @return			the axis aligned bounding box of the rotated convex hull
+ */
+BBox GraphUtil::getMinAreaBoundingBox(const std::vector<QVector2D>& hull, float theta1, float theta2, float& theta) {
+	int n = hull.size();
+	theta = theta1;
+
+	// the candidates of the angle with their areas
+	std::vector<std::pair<float, float> > candidates;
+
+	if (n >= 2) {
+		int r = 0, t = 0, l = 0;
+		for (int i = 0; i < n; i++) {
+			QVector2D u = (hull[(i + 1) % n] - hull[i]).normalized();
+			QVector2D v(-u.y(), u.x());
+
+			// the farthest point in the direction of the edge, in the normal direction, and in the opposite direction of the edge
+			if (i == 0) r = 1;
+			while (QVector2D::dotProduct(hull[(r + 1) % n] - hull[r % n], u) > 0) r++;
+			if (i == 0) t = r;
+			while (QVector2D::dotProduct(hull[(t + 1) % n] - hull[t % n], v) > 0) t++;
+			if (i == 0) l = t;
+			while (QVector2D::dotProduct(hull[(l + 1) % n] - hull[l % n], u) < 0) l++;
+
+			float area = QVector2D::dotProduct(hull[r % n] - hull[l % n], u) * QVector2D::dotProduct(hull[t % n] - hull[i], v);
+
+			// the rotation that aligns the edge to X axis, which is the same as the ones by every 90 degree
+			float angle = -atan2f(u.y(), u.x());
+			angle -= floor((angle - theta1) / (M_PI * 0.5f)) * M_PI * 0.5f;
+			if (angle <= theta2) candidates.push_back(std::make_pair(area, angle));
+		}
+	}
+
+	// both ends of the range
+	for (int i = 0; i < 2; i++) {
+		float angle = i == 0 ? theta1 : theta2;
+		BBox box = getAABoundingBox(hull, angle);
+		candidates.push_back(std::make_pair(box.dx() * box.dy(), angle));
+	}
+
+	float min_area = std::numeric_limits<float>::max();
+	for (int i = 0; i < candidates.size(); i++) {
+		if (candidates[i].first < min_area) {
+			min_area = candidates[i].first;
+			theta = candidates[i].second;
 		}
+	}
+
+	return getAABoundingBox(hull, theta);
+}
+
+/**
+ * Return the axis aligned bounding box of the points rotated by theta in the same way as rotate.
+ */
+BBox GraphUtil::getAABoundingBox(const std::vector<QVector2D>& pts, float theta) {
+	BBox box;
 
-		delete rotated_roads;
+	for (int i = 0; i < pts.size(); i++) {
+		box.addPoint(QVector2D(cosf(theta) * pts[i].x() - sinf(theta) * pts[i].y(), sinf(theta) * pts[i].x() + cosf(theta) * pts[i].y()));
 	}
 
-	rotate(roads, min_theta);
-	return min_box;
+	return box;
 }
 
 /**
@@ -897,9 +1215,8 @@ RoadGraph* GraphUtil::extractMajorRoad(RoadGraph* roads, bool remove) {
 		if (conv.contains(src)) {
 			new_src = conv[src];
 		} else {
-			RoadVertex* v = new RoadVertex(roads->graph[src]->getPt());
-			new_src = boost::add_vertex(new_roads->graph);
-			new_roads->graph[new_src] = v;
+			RoadVertex* v = new_roads->createVertex(roads->graph[src]->getPt());
+			new_src = new_roads->addVertex(v);
 			conv[src] = new_src;
 		}
 
@@ -908,9 +1225,8 @@ RoadGraph* GraphUtil::extractMajorRoad(RoadGraph* roads, bool remove) {
 		if (conv.contains(tgt)) {
 			new_tgt = conv[tgt];
 		} else {
-			RoadVertex* v = new RoadVertex(roads->graph[tgt]->getPt());
-			new_tgt = boost::add_vertex(new_roads->graph);
-			new_roads->graph[new_tgt] = v;
+			RoadVertex* v = new_roads->createVertex(roads->graph[tgt]->getPt());
+			new_tgt = new_roads->addVertex(v);
 			conv[tgt] = new_tgt;
 		}
 
@@ -920,7 +1236,7 @@ RoadGraph* GraphUtil::extractMajorRoad(RoadGraph* roads, bool remove) {
 
 		if (remove) {
 			// remove the edge from the original road graph.
-			roads->graph[e]->valid = false;
+			roads->setValid(e, false);
 		}
 	}
 
@@ -1034,8 +1350,11 @@ bool GraphUtil::isNeighbor(RoadGraph* roads, RoadVertexDesc v1, RoadVertexDesc v
 
 /**
  * Check if desc2 is reachable from desc1.
+ * Only for the valid edges, the connected components cached by the road graph are used (see RoadGraph::isConnected).
  */
 bool GraphUtil::isConnected(RoadGraph* roads, RoadVertexDesc desc1, RoadVertexDesc desc2, bool onlyValidEdge) {
+	if (onlyValidEdge) return roads->isConnected(desc1, desc2);
+
 	QList<RoadVertexDesc> seeds;
 	QSet<RoadVertexDesc> visited;
 
@@ -1152,8 +1471,21 @@ RoadVertexDesc GraphUtil::findConnectedNearestNeighbor(RoadGraph* roads, const Q
 /**
  * Find the edge which is the closest to the specified point.
  * If the distance is within the threshold, return true. Otherwise, return false.
+ * If the segment index is enabled and onlyValidEdge is true, only the edges within the threshold are searched,
+ * so e is not updated when false is returned.
  */
 bool GraphUtil::getEdge(RoadGraph* roads, const QVector2D &pt, float threshold, RoadEdgeDesc& e, bool onlyValidEdge) {
+	if (roads->segmentGrid != NULL && onlyValidEdge) {
+		RoadEdgeDesc nearest_e;
+		float dist;
+		QVector2D closestPt;
+		if (!roads->segmentGrid->findNearest(roads, pt, threshold, boost::graph_traits<BGLGraph>::null_vertex(), nearest_e, dist, closestPt)) return false;
+		if (dist >= threshold) return false;
+
+		e = nearest_e;
+		return true;
+	}
+
 	float min_dist = std::numeric_limits<float>::max();
 	RoadEdgeDesc min_e;
 
@@ -1184,11 +1516,18 @@ bool GraphUtil::getEdge(RoadGraph* roads, const QVector2D &pt, float threshold,
 /**
  * 指定された頂点に最も近いエッジを返却する。
  * ただし、指定された頂点に隣接するエッジは、対象外とする。
+ * 距離は、エッジのポリラインに対して計算する。
+ * Segment indexが有効な場合は、それを使って探索する。
  */
 RoadEdgeDesc GraphUtil::findNearestEdge(RoadGraph* roads, RoadVertexDesc v, float& dist, QVector2D &closestPt, bool onlyValidEdge) {
 	dist = std::numeric_limits<float>::max();
 	RoadEdgeDesc min_e;
 
+	if (roads->segmentGrid != NULL && onlyValidEdge) {
+		roads->segmentGrid->findNearest(roads, roads->graph[v]->getPt(), std::numeric_limits<float>::max(), v, min_e, dist, closestPt);
+		return min_e;
+	}
+
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
 		if (onlyValidEdge && !roads->graph[*ei]->valid) continue;
@@ -1201,7 +1540,7 @@ RoadEdgeDesc GraphUtil::findNearestEdge(RoadGraph* roads, RoadVertexDesc v, floa
 		if (onlyValidEdge && !roads->graph[tgt]->valid) continue;
 
 		QVector2D pt2;
-		float d = Util::pointSegmentDistanceXY(roads->graph[src]->getPt(), roads->graph[tgt]->getPt(), roads->graph[v]->getPt(), pt2);
+		float d = Util::pointPolylineDistanceXY(roads->graph[*ei]->getPolyLine(), roads->graph[v]->getPt(), pt2);
 		if (d < dist) {
 			dist = d;
 			min_e = *ei;
@@ -1213,66 +1552,246 @@ RoadEdgeDesc GraphUtil::findNearestEdge(RoadGraph* roads, RoadVertexDesc v, floa
 }
 
 /**
- * Clean the road graph by removing all the invalid vertices and edges.
+ * Return all the edges within the radius from the specified point.
+ * The edges incident to the vertex "ignore" are excluded (specify null_vertex() not to exclude any edge).
  */
-void GraphUtil::clean(RoadGraph* roads) {
-	RoadGraph* temp = GraphUtil::copyRoads(roads);
+std::vector<RoadEdgeDesc> GraphUtil::getEdgesInRadius(RoadGraph* roads, const QVector2D& pt, float radius, RoadVertexDesc ignore, bool onlyValidEdge) {
+	if (roads->segmentGrid != NULL && onlyValidEdge) {
+		return roads->segmentGrid->findInRadius(roads, pt, radius, ignore);
+	}
 
-	roads->clear();
+	std::vector<RoadEdgeDesc> ret;
 
-	QMap<RoadVertexDesc, RoadVertexDesc> conv;
-	RoadVertexIter vi, vend;
-	for (boost::tie(vi, vend) = boost::vertices(temp->graph); vi != vend; ++vi) {
-		if (!temp->graph[*vi]->valid) continue;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
+		if (onlyValidEdge && !roads->graph[*ei]->valid) continue;
 
-		// Add a vertex
-		RoadVertex* new_v = new RoadVertex(temp->graph[*vi]->getPt());
-		RoadVertexDesc new_v_desc = boost::add_vertex(roads->graph);
-		roads->graph[new_v_desc] = new_v;	
+		RoadVertexDesc src = boost::source(*ei, roads->graph);
+		RoadVertexDesc tgt = boost::target(*ei, roads->graph);
+		if (src == ignore || tgt == ignore) continue;
 
-		conv[*vi] = new_v_desc;
+		if (onlyValidEdge && !roads->graph[src]->valid) continue;
+		if (onlyValidEdge && !roads->graph[tgt]->valid) continue;
+
+		QVector2D pt2;
+		if (Util::pointPolylineDistanceXY(roads->graph[*ei]->getPolyLine(), pt, pt2) <= radius) ret.push_back(*ei);
+	}
+
+	return ret;
+}
+
+/**
+ * Return the edges which may pass through the rectangle (e.g. the area visible from the camera).
+ * All the edges passing through the rectangle are returned, but some edges near the rectangle may be also returned.
+ * The bounding boxes of the edges are checked against the rectangle. If the spatial index of the segments is enabled,
+ * only the edges registered in the cells overlapping with the rectangle are checked.
+ */
+std::vector<RoadEdgeDesc> GraphUtil::getEdgesInRect(RoadGraph* roads, const BBox& rect, bool onlyValidEdge) {
+	if (roads->segmentGrid != NULL && onlyValidEdge) {
+		return roads->segmentGrid->findInRect(roads, rect);
 	}
 
+	std::vector<RoadEdgeDesc> ret;
+
 	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(temp->graph); ei != eend; ++ei) {
-		if (!temp->graph[*ei]->valid) continue;
+	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
+		if (onlyValidEdge && !roads->graph[*ei]->valid) continue;
+
+		RoadVertexDesc src = boost::source(*ei, roads->graph);
+		RoadVertexDesc tgt = boost::target(*ei, roads->graph);
+		if (onlyValidEdge && !roads->graph[src]->valid) continue;
+		if (onlyValidEdge && !roads->graph[tgt]->valid) continue;
 
-		RoadVertexDesc src = boost::source(*ei, temp->graph);
-		RoadVertexDesc tgt = boost::target(*ei, temp->graph);
+		BBox bbox = roads->graph[*ei]->getBBox();
+		if (bbox.overlapsWithBBoxXY(rect)) ret.push_back(*ei);
+	}
 
-		RoadVertexDesc new_src = conv[src];
-		RoadVertexDesc new_tgt = conv[tgt];
+	return ret;
+}
 
-		// Add an edge
-		RoadEdge* new_e = new RoadEdge(*temp->graph[*ei]);
-		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(new_src, new_tgt, roads->graph);
-		roads->graph[edge_pair.first] = new_e;
+/**
+ * Clean the road graph by removing all the invalid vertices and edges.
+ * The valid vertices and edges are collected first, and then the adjacency is cleared and rebuilt only with them.
+ * Their RoadVertex and RoadEdge objects are moved to the new adjacency as they are, i.e. not copied,
+ * and only the invalid ones are deleted. The edges whose end vertex is invalid are removed as well.
+ * The generational handles of the remaining vertices and edges are kept valid, and those of the removed ones become stale.
+ *
+ * @return		the conversion table from the old vertex descriptors to the new ones.
+ *				The removed vertices are mapped to boost::graph_traits<BGLGraph>::null_vertex().
+ */
+std::vector<RoadVertexDesc> GraphUtil::clean(RoadGraph* roads) {
+	RoadVertexDesc null_v = boost::graph_traits<BGLGraph>::null_vertex();
+	std::vector<RoadVertexDesc> conv(boost::num_vertices(roads->graph), null_v);
+
+	// assign the new descriptors to the valid vertices
+	int nVertices = 0;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (!roads->graph[*vi]->valid) continue;
+
+		conv[*vi] = nVertices++;
+	}
+
+	// collect the valid edges, and delete the invalid ones
+	std::vector<RoadVertexDesc> srcs;
+	std::vector<RoadVertexDesc> tgts;
+	std::vector<RoadEdge*> edges;
+	std::vector<int> edgeSlots;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
+		RoadEdge* edge = roads->graph[*ei];
+
+		RoadVertexDesc new_src = conv[boost::source(*ei, roads->graph)];
+		RoadVertexDesc new_tgt = conv[boost::target(*ei, roads->graph)];
+
+		if (!edge->valid || new_src == null_v || new_tgt == null_v) {
+			roads->releaseHandle(*ei);
+			if (roads->owns(edge)) roads->destroy(edge);
+			continue;
+		}
+
+		srcs.push_back(new_src);
+		tgts.push_back(new_tgt);
+		edges.push_back(edge);
+		edgeSlots.push_back(roads->findSlot(*ei));
+	}
+
+	// collect the valid vertices, and delete the invalid ones
+	std::vector<RoadVertex*> vertices(nVertices);
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (conv[*vi] == null_v) {
+			roads->releaseHandle(*vi);
+			if (roads->owns(roads->graph[*vi])) roads->destroy(roads->graph[*vi]);
+		} else {
+			roads->updateHandle(*vi, conv[*vi]);
+			vertices[conv[*vi]] = roads->graph[*vi];
+		}
+	}
+
+	// Rebuild the adjacency. It only holds the pointers, which are either moved or deleted.
+	roads->graph.clear();
+	for (int i = 0; i < nVertices; i++) {
+		RoadVertexDesc desc = boost::add_vertex(roads->graph);
+		roads->graph[desc] = vertices[i];
+	}
+	for (int i = 0; i < edges.size(); i++) {
+		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(srcs[i], tgts[i], roads->graph);
+		roads->graph[edge_pair.first] = edges[i];
+		roads->updateHandle(edgeSlots[i], edge_pair.first);
 	}
+
+	roads->rebuildIndices();
+	roads->modified = true;
+
+	return conv;
 }
 
 /**
  * Remove the vertices of degree of 2, and make it as a part of an edge.
+ * Each maximal chain of the vertices of degree 2 is walked only once, and replaced by one edge between its ends.
+ * The vertices which would form a triangle are kept in the same way as removing the vertices one by one (see reduce(roads, desc)).
  */
 void GraphUtil::reduce(RoadGraph* roads) {
-	// reduce the graph by removing the vertices which have two outing edges.
+	std::vector<bool> visited(boost::num_vertices(roads->graph), false);
+
 	RoadVertexIter vi, vend;
-	bool deleted = false;
-	do {
-		deleted = false;
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (!roads->graph[*vi]->valid) continue;
+		if (visited[*vi] || getDegree(roads, *vi) != 2) continue;
 
-		for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
-			if (!roads->graph[*vi]->valid) continue;
+		visited[*vi] = true;
 
-			RoadVertex* v = roads->graph[*vi];
+		RoadEdgeDesc ed[2];
+		int count = 0;
+		RoadOutEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::out_edges(*vi, roads->graph); ei != eend; ++ei) {
+			if (!roads->graph[*ei]->valid) continue;
 
-			if (getDegree(roads, *vi) == 2) {
-				if (reduce(roads, *vi)) {
-					deleted = true;
+			ed[count++] = *ei;
+		}
+
+		// walk the chain to the both directions until a vertex of degree other than 2 is found
+		std::vector<RoadVertexDesc> vertices[2];
+		std::vector<RoadEdgeDesc> edges[2];
+		bool ring = false;
+		for (int i = 0; i < 2 && !ring; i++) {
+			RoadEdgeDesc e = ed[i];
+			while (true) {
+				RoadVertexDesc v = boost::target(e, roads->graph);
+				vertices[i].push_back(v);
+				edges[i].push_back(e);
+
+				if (v == *vi) {
+					ring = true;
+					break;
+				}
+				if (getDegree(roads, v) != 2) break;
+
+				visited[v] = true;
+
+				for (boost::tie(ei, eend) = boost::out_edges(v, roads->graph); ei != eend; ++ei) {
+					if (!roads->graph[*ei]->valid) continue;
+					if (*ei == e) continue;
+
+					e = *ei;
 					break;
 				}
 			}
 		}
-	} while (deleted);
+
+		std::vector<RoadVertexDesc> chain;
+		std::vector<RoadEdgeDesc> chainEdges;
+		if (ring) {
+			// the ring is handled as a chain which starts and ends at its largest vertex
+			std::vector<RoadVertexDesc> cycle(1, *vi);
+			cycle.insert(cycle.end(), vertices[0].begin(), vertices[0].end() - 1);
+			int m = std::max_element(cycle.begin(), cycle.end()) - cycle.begin();
+			for (int i = 0; i <= cycle.size(); i++) {
+				chain.push_back(cycle[(m + i) % cycle.size()]);
+				if (i < cycle.size()) chainEdges.push_back(edges[0][(m + i) % cycle.size()]);
+			}
+		} else {
+			chain.assign(vertices[1].rbegin(), vertices[1].rend());
+			chain.push_back(*vi);
+			chain.insert(chain.end(), vertices[0].begin(), vertices[0].end());
+			chainEdges.assign(edges[1].rbegin(), edges[1].rend());
+			chainEdges.insert(chainEdges.end(), edges[0].begin(), edges[0].end());
+		}
+
+		// If the vertices of the chain would form a triangle, keep them.
+		// One vertex is kept if the ends are connected by another edge, and two are kept if the chain is a loop.
+		int numMiddles = chain.size() - 2;
+		int numKept = 0;
+		if (chain.front() != chain.back()) {
+			if (hasEdge(roads, chain.front(), chain.back())) numKept = 1;
+		} else if (numMiddles >= 2) {
+			numKept = 2;
+		} else if (hasEdge(roads, chain.front(), chain.back())) {
+			numKept = 1;
+		}
+		numKept = std::min(numKept, numMiddles);
+
+		// the largest vertices are kept, since the vertices are removed from the smallest one when they are removed one by one
+		std::vector<std::pair<RoadVertexDesc, int> > middles;
+		for (int i = 1; i < chain.size() - 1; i++) {
+			middles.push_back(std::make_pair(chain[i], i));
+		}
+		std::sort(middles.begin(), middles.end());
+
+		std::vector<int> splits;
+		splits.push_back(0);
+		for (int i = 0; i < numKept; i++) {
+			splits.push_back(middles[middles.size() - 1 - i].second);
+		}
+		splits.push_back(chain.size() - 1);
+		std::sort(splits.begin(), splits.end());
+
+		for (int i = 0; i < splits.size() - 1; i++) {
+			if (splits[i + 1] - splits[i] < 2) continue;
+
+			reduceChain(roads, std::vector<RoadVertexDesc>(chain.begin() + splits[i], chain.begin() + splits[i + 1] + 1), std::vector<RoadEdgeDesc>(chainEdges.begin() + splits[i], chainEdges.begin() + splits[i + 1]));
+		}
+	}
 }
 
 /**
@@ -1282,7 +1801,6 @@ bool GraphUtil::reduce(RoadGraph* roads, RoadVertexDesc desc) {
 	int count = 0;
 	RoadVertexDesc vd[2];
 	RoadEdgeDesc ed[2];
-	RoadEdge* edges[2];
 
 	RoadOutEdgeIter ei, ei_end;
 	for (boost::tie(ei, ei_end) = out_edges(desc, roads->graph); ei != ei_end; ++ei) {
@@ -1290,7 +1808,6 @@ bool GraphUtil::reduce(RoadGraph* roads, RoadVertexDesc desc) {
 
 		vd[count] = boost::target(*ei, roads->graph);
 		ed[count] = *ei;
-		edges[count] = roads->graph[*ei];
 		count++;
 	}
 
@@ -1300,48 +1817,87 @@ bool GraphUtil::reduce(RoadGraph* roads, RoadVertexDesc desc) {
 	// If the vertices form a triangle, don't remove it.
 	if (hasEdge(roads, vd[0], vd[1])) return false;
 
-	RoadEdge* new_edge = new RoadEdge(edges[0]->oneWay, edges[0]->lanes, edges[0]->type);
-	orderPolyLine(roads, ed[0], vd[0]);
-	orderPolyLine(roads, ed[1], desc);
-	
-	for (int i = 0; i < edges[0]->getPolyLine().size(); i++) {
-		new_edge->addPoint(edges[0]->getPolyLine()[i]);
+	std::vector<RoadVertexDesc> chain;
+	chain.push_back(vd[0]);
+	chain.push_back(desc);
+	chain.push_back(vd[1]);
+
+	std::vector<RoadEdgeDesc> edges;
+	edges.push_back(ed[0]);
+	edges.push_back(ed[1]);
+
+	reduceChain(roads, chain, edges);
+
+	return true;
+}
+
+/**
+ * Replace the chain of the edges by one edge between the both ends, and remove the vertices in the middle.
+ * The i-th edge connects chain[i] and chain[i + 1]. The polylines are concatenated in the order of the chain,
+ * and the new edge takes over the lanes, type, and oneWay of the first edge.
+ */
+RoadEdgeDesc GraphUtil::reduceChain(RoadGraph* roads, const std::vector<RoadVertexDesc>& chain, const std::vector<RoadEdgeDesc>& edges) {
+	RoadEdge* first = roads->graph[edges[0]];
+	RoadEdge* new_edge = roads->createEdge(first->lanes, first->type, first->oneWay);
+
+	int numPoints = 1;
+	for (int i = 0; i < edges.size(); i++) {
+		numPoints += roads->graph[edges[i]]->getPolyLine().size() - 1;
 	}
-	for (int i = 1; i < edges[1]->getPolyLine().size(); i++) {
-		new_edge->addPoint(edges[1]->getPolyLine()[i]);
+	new_edge->polyLine.reserve(numPoints);
+
+	for (int i = 0; i < edges.size(); i++) {
+		// the polyline is read from chain[i] without reordering the points of the edge
+		const std::vector<QVector2D>& polyLine = roads->graph[edges[i]]->getPolyLine();
+		bool reversed = (roads->graph[chain[i]]->getPt() - polyLine[0]).length() > (roads->graph[chain[i + 1]]->getPt() - polyLine[0]).length();
+		PolyLineView view(polyLine, reversed);
+
+		for (int j = (i == 0) ? 0 : 1; j < view.size(); j++) {
+			new_edge->addPoint(view[j]);
+		}
 	}
-	std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(vd[0], vd[1], roads->graph);
-	roads->graph[edge_pair.first] = new_edge;
+	RoadEdgeDesc e = roads->addEdge(chain.front(), chain.back(), new_edge);
 
-	// invalidate the old edge
-	roads->graph[ed[0]]->valid = false;
-	roads->graph[ed[1]]->valid = false;
+	// invalidate the old edges
+	for (int i = 0; i < edges.size(); i++) {
+		roads->setValid(edges[i], false);
+	}
 
-	// invalidate the vertex
-	roads->graph[desc]->valid = false;
+	// invalidate the vertices in the middle
+	for (int i = 1; i < chain.size() - 1; i++) {
+		roads->setValid(chain[i], false);
+	}
 
-	return true;
+	return e;
 }
 
 /**
  * ノード間の距離が指定した距離よりも近い場合は、１つにしてしまう。
  * ノードとエッジ間の距離が、閾値よりも小さい場合も、エッジ上にノードを移してしまう。
+ *
+ * The closest vertex is merged one by one, and the vertex is moved to the midpoint each time.
+ * The closest vertex is searched around the updated position by the vertex index, and the closest edge by the segment index,
+ * so each query only visits the cells around the vertex.
  */
 void GraphUtil::simplify(RoadGraph* roads, float dist_threshold) {
+	// the vertex and segment indices are used only during this pass
+	bool vertexIndexed = roads->vertexGrid != NULL;
+	bool segmentIndexed = roads->segmentGrid != NULL;
+	roads->enableVertexIndex(dist_threshold);
+	roads->enableSegmentIndex(dist_threshold);
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
 		if (!roads->graph[*vi]->valid) continue;
 
 		while (true) {
-			//RoadVertexDesc v2 = findNearestVertex(roads, roads->graph[*vi]->getPt(), *vi);
 			RoadVertexDesc v2;
 			if (!getVertex(roads, roads->graph[*vi]->getPt(), dist_threshold, *vi, v2)) break;
-			//if ((roads->graph[v2]->getPt() - roads->graph[*vi]->getPt()).length() > dist_threshold) break;
 
-			QVector2D pt = (roads->graph[*vi]->pt + roads->graph[v2]->pt) / 2.0f;
+			QVector2D pt = (roads->graph[*vi]->getPt() + roads->graph[v2]->getPt()) / 2.0f;
 
 			collapseVertex(roads, v2, *vi);
-			roads->graph[*vi]->pt = pt;
+			roads->setPt(*vi, pt);
 		}
 
 		// find the closest vertex
@@ -1357,7 +1913,7 @@ void GraphUtil::simplify(RoadGraph* roads, float dist_threshold) {
 			RoadVertexDesc tgt = boost::target(e, roads->graph);
 
 			// invalidate the edge
-			roads->graph[e]->valid = false;
+			roads->setValid(e, false);
 
 			// update the edge
 			if (!GraphUtil::hasEdge(roads, src, *vi)) {
@@ -1368,6 +1924,9 @@ void GraphUtil::simplify(RoadGraph* roads, float dist_threshold) {
 			}
 		}
 	}
+
+	if (!vertexIndexed) roads->disableVertexIndex();
+	if (!segmentIndexed) roads->disableSegmentIndex();
 }
 
 /**
@@ -1377,17 +1936,18 @@ void GraphUtil::normalize(RoadGraph* roads) {
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
 		if (!roads->graph[*ei]->valid) continue;
-		if (roads->graph[*ei]->getPolyLine().size() <= 2) continue;
+		const std::vector<QVector2D>& polyLine = roads->graph[*ei]->getPolyLine();
+		if (polyLine.size() <= 2) continue;
 
 		// invalidate the edge
-		roads->graph[*ei]->valid = false;
+		roads->setValid(*ei, false);
 
 		RoadVertexDesc src = boost::source(*ei, roads->graph);
 		RoadVertexDesc tgt = boost::target(*ei, roads->graph);
 
 		RoadVertexDesc prev_desc;
 		RoadVertexDesc last_desc;
-		if ((roads->graph[src]->getPt() - roads->graph[*ei]->getPolyLine()[0]).length() < (roads->graph[tgt]->getPt() - roads->graph[*ei]->getPolyLine()[0]).length()) {
+		if ((roads->graph[src]->getPt() - polyLine[0]).length() < (roads->graph[tgt]->getPt() - polyLine[0]).length()) {
 			prev_desc = src;
 			last_desc = tgt;
 		} else {
@@ -1395,11 +1955,10 @@ void GraphUtil::normalize(RoadGraph* roads) {
 			last_desc = src;
 		}
 
-		for (int i = 1; i < roads->graph[*ei]->getPolyLine().size() - 1; i++) {
+		for (int i = 1; i < polyLine.size() - 1; i++) {
 			// add all the points along the poly line as vertices
-			RoadVertex* new_v = new RoadVertex(roads->graph[*ei]->getPolyLine()[i]);
-			RoadVertexDesc new_v_desc = boost::add_vertex(roads->graph);
-			roads->graph[new_v_desc] = new_v;
+			RoadVertex* new_v = roads->createVertex(polyLine[i]);
+			RoadVertexDesc new_v_desc = roads->addVertex(new_v);
 
 			// Add an edge
 			addEdge(roads, prev_desc, new_v_desc, roads->graph[*ei]->lanes, roads->graph[*ei]->type, roads->graph[*ei]->oneWay);
@@ -1413,95 +1972,56 @@ void GraphUtil::normalize(RoadGraph* roads) {
 }
 
 /**
- * start頂点と接続されているノードのみ有効とし、それ以外のノード、およびエッジを、全て無効にする。
- * 本実装では、事前の有効・無効フラグを考慮していない。要検討。。。
+ * 最も大きいかたまり（接続されている）の道路網のみを残し、それ以外のノード、およびエッジを、全て削除する。
+ * The connected components are labeled in one pass (see RoadGraph::getComponent), and the vertices of the other components
+ * are invalidated and removed in place by the compaction (see clean), so the remaining vertices and edges are kept as they are.
+ *
+ * @return		the conversion table from the old vertex descriptors to the new ones (see clean).
  */
-void GraphUtil::singlify(RoadGraph* roads) {
-	int max_size = 0;
-	RoadVertexDesc start;
-
-	// 最も大きいかたまり（接続されている）の道路網を探し出す
+std::vector<RoadVertexDesc> GraphUtil::singlify(RoadGraph* roads) {
+	// 各かたまりの頂点数を数える
+	std::vector<int> components(boost::num_vertices(roads->graph), -1);
+	std::vector<int> sizes;
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
-		if (!roads->graph[*vi]->valid) continue;
+		components[*vi] = roads->getComponent(*vi);
+		if (components[*vi] < 0) continue;
 
-		int size = getNumConnectedVertices(roads, *vi);
-		if (size > max_size) {
-			max_size = size;
-			start = *vi;
-		}
+		if (components[*vi] >= sizes.size()) sizes.resize(components[*vi] + 1, 0);
+		sizes[components[*vi]]++;
 	}
 
-	RoadGraph* new_roads = new RoadGraph();
-
-	std::list<RoadVertexDesc> queue;
-	queue.push_back(start);
-
-	QMap<RoadVertexDesc, RoadVertexDesc> conv;
-
-	// Add the starting vertex
-	RoadVertex* new_v = new RoadVertex(roads->graph[start]->getPt());
-	RoadVertexDesc new_v_desc = boost::add_vertex(new_roads->graph);
-	new_roads->graph[new_v_desc] = new_v;
-
-	conv[start] = new_v_desc;
-
-	std::list<RoadVertexDesc> queue2;
-	queue2.push_back(new_v_desc);
-
-	while (!queue.empty()) {
-		RoadVertexDesc v_desc = queue.front();
-		queue.pop_front();
-
-		RoadVertexDesc new_v_desc = queue2.front();
-		queue2.pop_front();
-
-
-		RoadOutEdgeIter oei, oeend;
-		for (boost::tie(oei, oeend) = boost::out_edges(v_desc, roads->graph); oei != oeend; ++oei) {
-			if (!roads->graph[*oei]->valid) continue;
-
-			RoadVertexDesc u_desc = boost::target(*oei, roads->graph);
-			if (!roads->graph[u_desc]->valid) continue;
-
-			RoadVertexDesc new_u_desc;
-
-			if (conv.contains(u_desc)) {
-				new_u_desc = conv[u_desc];
-			} else {
-				// Add a vertex
-				RoadVertex* new_u = new RoadVertex(roads->graph[u_desc]->getPt());
-				new_u_desc = boost::add_vertex(new_roads->graph);
-				new_roads->graph[new_u_desc] = new_u;
-			}
-
-			// Add an edge
-			if (!hasEdge(new_roads, new_v_desc, new_u_desc)) {
-				addEdge(new_roads, new_v_desc, new_u_desc, roads->graph[*oei]);
-			}
+	// 最も大きいかたまりを探し出す（同じ大きさの場合は、番号の小さい頂点を含むかたまり）
+	int largest = std::max_element(sizes.begin(), sizes.end()) - sizes.begin();
 
-			if (!conv.contains(u_desc)) {
-				conv[u_desc] = new_u_desc;
-				queue.push_back(u_desc);
-				queue2.push_back(new_u_desc);
-			}
+	// それ以外の頂点を無効にする（それらのエッジは、cleanで削除される）
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (components[*vi] >= 0 && components[*vi] != largest) {
+			roads->setValid(*vi, false);
 		}
 	}
 
-	// copy new_roads to roads
-	copyRoads(new_roads, roads);
-	delete new_roads;
+	return clean(roads);
 }
 
 /**
  * Convert the road graph to a planar graph.
+ * All the crossings are found in one pass, and each edge is split at all of its crossings at once.
+ * The split edges keep the shape of their polylines, so the new edges never make new crossings.
+ *
+ * @param parallel	if true, the crossings are found on all the cores (see findEdgeCrossings). The result is the same as the serial one.
  */
-void GraphUtil::planarify(RoadGraph* roads) {
-	bool split = true;
+void GraphUtil::planarify(RoadGraph* roads, bool parallel) {
+	std::vector<RoadEdgeDesc> edges;
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
+		if (!roads->graph[*ei]->valid) continue;
 
-	while (split) {
-		split = planarifyOne(roads);
+		edges.push_back(*ei);
 	}
+
+	std::vector<EdgeCrossing> crossings = findEdgeCrossings(roads, edges, parallel);
+	splitEdgesAtCrossings(roads, edges, crossings);
 }
 
 /**
@@ -1537,13 +2057,12 @@ bool GraphUtil::planarifyOne(RoadGraph* roads) {
 						if ((roads->graph[src]->pt - intPt).length() < 10 || (roads->graph[tgt]->pt - intPt).length() < 10 || (roads->graph[src2]->pt - intPt).length() < 10 || (roads->graph[tgt2]->pt - intPt).length() < 10) continue;
 
 						// 交点をノードとして登録
-						RoadVertex* new_v = new RoadVertex(intPt);
-						RoadVertexDesc new_v_desc = boost::add_vertex(roads->graph);
-						roads->graph[new_v_desc] = new_v;
+						RoadVertex* new_v = roads->createVertex(intPt);
+						RoadVertexDesc new_v_desc = roads->addVertex(new_v);
 
 						// もともとのエッジを無効にする
-						roads->graph[*ei]->valid = false;
-						roads->graph[*ei2]->valid = false;
+						roads->setValid(*ei, false);
+						roads->setValid(*ei2, false);
 
 						// 新たなエッジを追加する
 						addEdge(roads, src, new_v_desc, roads->graph[*ei]->lanes, roads->graph[*ei]->type, roads->graph[*ei]->oneWay);
@@ -1562,23 +2081,319 @@ bool GraphUtil::planarifyOne(RoadGraph* roads) {
 	return false;
 }
 
+/**
+ * Find all the crossings between the polyline segments of the edges.
+ * The segments are registered to a uniform grid, and only the segments in the same cell are tested.
+ * A crossing is reported only by the cell which contains the crossing point, so that it is not reported twice.
+ * The cell is clamped to the cells which have both segments, because the rounded crossing point of the segments
+ * on the border of the cells may fall in the cell next to them.
+ * Unlike planarifyOne, the edges which share an end vertex are also tested because they may cross after one of them is split.
+ *
+ * In the parallel mode, the bounding box of the road graph is partitioned into tiles of the cells, and the tiles are processed on all the cores.
+ * Each segment is given to all the tiles its cells overlap, and a crossing on the border of the tiles
+ * is reported only by the tile which contains the clamped cell above. The cell depends only on the two segments,
+ * so each crossing is reported by exactly one tile, and the sorted list is exactly the same as the serial mode.
+ *
+ * @param edges		the edges to be tested
+ * @param parallel	true to find the crossings on all the cores
+ * @return			the crossings in the order of EdgeCrossing::operator<
+ */
+std::vector<EdgeCrossing> GraphUtil::findEdgeCrossings(RoadGraph* roads, const std::vector<RoadEdgeDesc>& edges, bool parallel) {
+	std::vector<EdgeCrossing> crossings;
+
+	// list all the segments, and decide the cell size by their average length
+	std::vector<std::pair<int, int> > segments;
+	float total_length = 0.0f;
+	for (int i = 0; i < edges.size(); i++) {
+		const std::vector<QVector2D>& polyLine = roads->graph[edges[i]]->getPolyLine();
+		for (int j = 0; j < (int)polyLine.size() - 1; j++) {
+			segments.push_back(std::make_pair(i, j));
+			total_length += (polyLine[j + 1] - polyLine[j]).length();
+		}
+	}
+	if (segments.size() == 0) return crossings;
+
+	EdgeCrossingTile base;
+	base.roads = roads;
+	base.edges = &edges;
+	base.segments = &segments;
+	base.cellSize = std::max(total_length / segments.size(), 1.0f);
+
+	// partition the bounding box into the tiles (a few tiles per core for the load balancing)
+	BBox box = getAABoundingBox(roads);
+	if (parallel && box.dx() >= 0.0f && box.dy() >= 0.0f) {
+		base.numTiles = std::max(1, (int)ceil(sqrt((float)QThread::idealThreadCount() * 4.0f)));
+		base.originCellX = (int)floor(box.minPt.x() / base.cellSize);
+		base.originCellY = (int)floor(box.minPt.y() / base.cellSize);
+		base.tileCellsX = ((int)floor(box.maxPt.x() / base.cellSize) - base.originCellX) / base.numTiles + 1;
+		base.tileCellsY = ((int)floor(box.maxPt.y() / base.cellSize) - base.originCellY) / base.numTiles + 1;
+	}
+
+	std::vector<EdgeCrossingTile> tiles(base.numTiles * base.numTiles, base);
+	for (int i = 0; i < tiles.size(); i++) {
+		tiles[i].tileX = i % base.numTiles;
+		tiles[i].tileY = i / base.numTiles;
+	}
+
+	// give each segment to the tiles which its cells overlap
+	for (int i = 0; i < segments.size(); i++) {
+		int cx0, cx1, cy0, cy1;
+		base.getCellRange(i, cx0, cx1, cy0, cy1);
+		for (int ty = base.toTileY(cy0); ty <= base.toTileY(cy1); ty++) {
+			for (int tx = base.toTileX(cx0); tx <= base.toTileX(cx1); tx++) {
+				tiles[ty * base.numTiles + tx].segmentIds.push_back(i);
+			}
+		}
+	}
+
+	if (tiles.size() > 1) {
+		QtConcurrent::blockingMap(tiles, findEdgeCrossingsInTile);
+	} else {
+		findEdgeCrossingsInTile(tiles[0]);
+	}
+
+	for (int i = 0; i < tiles.size(); i++) {
+		crossings.insert(crossings.end(), tiles[i].crossings.begin(), tiles[i].crossings.end());
+	}
+
+	std::sort(crossings.begin(), crossings.end());
+
+	return crossings;
+}
+
+/**
+ * Find the crossings between the segments of the tile, which are located in the tile.
+ * The cells are the same as the serial mode, so each crossing is tested in the same cell.
+ */
+void GraphUtil::findEdgeCrossingsInTile(EdgeCrossingTile& tile) {
+	RoadGraph* roads = tile.roads;
+	const std::vector<RoadEdgeDesc>& edges = *tile.edges;
+	const std::vector<std::pair<int, int> >& segments = *tile.segments;
+	float cellSize = tile.cellSize;
+
+	// register the segments to the cells which their bounding boxes cover
+	// (the cells keep the indices of the segments in the tile)
+	QHash<quint64, std::vector<int> > cells;
+	std::vector<int> ranges(tile.segmentIds.size() * 4);
+	for (int k = 0; k < tile.segmentIds.size(); k++) {
+		int* range = &ranges[k * 4];
+		tile.getCellRange(tile.segmentIds[k], range[0], range[1], range[2], range[3]);
+		for (int cy = range[2]; cy <= range[3]; cy++) {
+			for (int cx = range[0]; cx <= range[1]; cx++) {
+				cells[((quint64)(unsigned int)cx << 32) | (quint64)(unsigned int)cy].push_back(k);
+			}
+		}
+	}
+
+	// test the pairs of the segments in each cell
+	for (QHash<quint64, std::vector<int> >::iterator it = cells.begin(); it != cells.end(); ++it) {
+		const std::vector<int>& cell = it.value();
+		for (int i = 0; i < cell.size(); i++) {
+			for (int j = 0; j < cell.size(); j++) {
+				int e1 = segments[tile.segmentIds[cell[i]]].first;
+				int e2 = segments[tile.segmentIds[cell[j]]].first;
+				if (e1 >= e2) continue;
+
+				int s1 = segments[tile.segmentIds[cell[i]]].second;
+				int s2 = segments[tile.segmentIds[cell[j]]].second;
+				const std::vector<QVector2D>& polyLine1 = roads->graph[edges[e1]]->getPolyLine();
+				const std::vector<QVector2D>& polyLine2 = roads->graph[edges[e2]]->getPolyLine();
+
+				float tab, tcd;
+				QVector2D intPt;
+				if (!Util::segmentSegmentIntersectXY(polyLine1[s1], polyLine1[s1 + 1], polyLine2[s2], polyLine2[s2 + 1], &tab, &tcd, true, intPt)) continue;
+
+				// report the crossing only in the cell which contains it.
+				// Since the crossing point is rounded, it may fall in a cell next to the segments on the border of the cells,
+				// so the cell is clamped to the cells which have both segments.
+				const int* range1 = &ranges[cell[i] * 4];
+				const int* range2 = &ranges[cell[j] * 4];
+				int cx = std::min(std::max((int)floor(intPt.x() / cellSize), std::max(range1[0], range2[0])), std::min(range1[1], range2[1]));
+				int cy = std::min(std::max((int)floor(intPt.y() / cellSize), std::max(range1[2], range2[2])), std::min(range1[3], range2[3]));
+				if ((((quint64)(unsigned int)cx << 32) | (quint64)(unsigned int)cy) != it.key()) continue;
+
+				// report the crossing only in the tile which contains the same cell
+				if (tile.toTileX(cx) != tile.tileX || tile.toTileY(cy) != tile.tileY) continue;
+
+				tile.crossings.push_back(EdgeCrossing(e1, s1, tab, e2, s2, tcd, intPt));
+			}
+		}
+	}
+}
+
+/**
+ * Split the edges at the crossings.
+ * The crossings on each edge are sorted by the position along its polyline once, and then the crossings are accepted
+ * in one pass in the order of the list with the same rules as planarifyOne, which are applied to the pieces of the edges
+ * split by the crossings accepted so far: a crossing closer than 10 to the ends of the pieces is ignored,
+ * and so is a crossing between the pieces which share an end.
+ * A vertex is added for each accepted crossing, and each edge is replaced by the pieces of its polyline between them.
+ *
+ * @param edges			the edges which the indices of the crossings refer to
+ * @param crossings		the crossings sorted by EdgeCrossing::operator<
+ */
+void GraphUtil::splitEdgesAtCrossings(RoadGraph* roads, const std::vector<RoadEdgeDesc>& edges, std::vector<EdgeCrossing>& crossings) {
+	// the end vertices of each edge in the order of the polyline
+	std::vector<RoadVertexDesc> firstVertices(edges.size());
+	std::vector<RoadVertexDesc> lastVertices(edges.size());
+	for (int i = 0; i < edges.size(); i++) {
+		RoadVertexDesc src = boost::source(edges[i], roads->graph);
+		RoadVertexDesc tgt = boost::target(edges[i], roads->graph);
+
+		const QVector2D& pt0 = roads->graph[edges[i]]->getPolyLine()[0];
+		if ((roads->graph[src]->getPt() - pt0).length() < (roads->graph[tgt]->getPt() - pt0).length()) {
+			firstVertices[i] = src;
+			lastVertices[i] = tgt;
+		} else {
+			firstVertices[i] = tgt;
+			lastVertices[i] = src;
+		}
+	}
+
+	// sort the crossings on each edge by the position along the polyline
+	typedef std::pair<std::pair<int, float>, int> SplitPoint;
+	std::vector<std::vector<SplitPoint> > splits(edges.size());
+	for (int i = 0; i < crossings.size(); i++) {
+		splits[crossings[i].edge1].push_back(SplitPoint(std::make_pair(crossings[i].segment1, crossings[i].t1), i));
+		splits[crossings[i].edge2].push_back(SplitPoint(std::make_pair(crossings[i].segment2, crossings[i].t2), i));
+	}
+
+	// the rank of each crossing on its two edges
+	std::vector<int> ranks[2];
+	ranks[0].resize(crossings.size());
+	ranks[1].resize(crossings.size());
+	for (int i = 0; i < edges.size(); i++) {
+		std::sort(splits[i].begin(), splits[i].end());
+		for (int j = 0; j < splits[i].size(); j++) {
+			int k = (crossings[splits[i][j].second].edge1 == i) ? 0 : 1;
+			ranks[k][splits[i][j].second] = j;
+		}
+	}
+
+	// the ranks of the accepted crossings on each edge
+	std::vector<std::set<int> > acceptedRanks(edges.size());
+	std::vector<bool> accepted(crossings.size(), false);
+
+	for (int i = 0; i < crossings.size(); i++) {
+		const EdgeCrossing& crossing = crossings[i];
+
+		// find the ends of the pieces of the two edges which contain the crossing
+		// (the index of the crossing, or -1 and the descriptor of the end vertex of the edge)
+		int ends[2][2];
+		RoadVertexDesc endVertices[2][2];
+		QVector2D endPts[2][2];
+		for (int k = 0; k < 2; k++) {
+			int e = (k == 0) ? crossing.edge1 : crossing.edge2;
+
+			std::set<int>::iterator next = acceptedRanks[e].lower_bound(ranks[k][i]);
+			if (next == acceptedRanks[e].begin()) {
+				ends[k][0] = -1;
+				endVertices[k][0] = firstVertices[e];
+				endPts[k][0] = roads->graph[firstVertices[e]]->pt;
+			} else {
+				std::set<int>::iterator prev = next;
+				--prev;
+				ends[k][0] = splits[e][*prev].second;
+				endPts[k][0] = crossings[ends[k][0]].pt;
+			}
+			if (next == acceptedRanks[e].end()) {
+				ends[k][1] = -1;
+				endVertices[k][1] = lastVertices[e];
+				endPts[k][1] = roads->graph[lastVertices[e]]->pt;
+			} else {
+				ends[k][1] = splits[e][*next].second;
+				endPts[k][1] = crossings[ends[k][1]].pt;
+			}
+		}
+
+		// エッジの端、ぎりぎりで、交差する場合は、交差させない
+		bool nearEnd = false;
+		for (int k = 0; k < 2; k++) {
+			for (int l = 0; l < 2; l++) {
+				if ((endPts[k][l] - crossing.pt).length() < 10) nearEnd = true;
+			}
+		}
+		if (nearEnd) continue;
+
+		// 端点を共有しているエッジどうしは、交差させない
+		bool shared = false;
+		for (int k = 0; k < 2; k++) {
+			for (int l = 0; l < 2; l++) {
+				if (ends[0][k] != ends[1][l]) continue;
+				if (ends[0][k] >= 0 || endVertices[0][k] == endVertices[1][l]) shared = true;
+			}
+		}
+		if (shared) continue;
+
+		acceptedRanks[crossing.edge1].insert(ranks[0][i]);
+		acceptedRanks[crossing.edge2].insert(ranks[1][i]);
+		accepted[i] = true;
+	}
+
+	// keep only the accepted crossings on each edge in the sorted order
+	for (int i = 0; i < edges.size(); i++) {
+		int n = 0;
+		for (int j = 0; j < splits[i].size(); j++) {
+			if (accepted[splits[i][j].second]) splits[i][n++] = splits[i][j];
+		}
+		splits[i].resize(n);
+	}
+
+	// 交点をノードとして登録
+	std::vector<RoadVertexDesc> crossingVertices(crossings.size());
+	for (int i = 0; i < crossings.size(); i++) {
+		if (!accepted[i]) continue;
+
+		RoadVertex* new_v = roads->createVertex(crossings[i].pt);
+		crossingVertices[i] = roads->addVertex(new_v);
+	}
+
+	for (int i = 0; i < edges.size(); i++) {
+		if (splits[i].empty()) continue;
+
+		RoadEdge* edge = roads->graph[edges[i]];
+		const std::vector<QVector2D>& polyLine = edge->getPolyLine();
+
+		// もともとのエッジを無効にする
+		roads->setValid(edges[i], false);
+
+		// 新たなエッジを追加する
+		RoadVertexDesc prev_desc = firstVertices[i];
+		std::vector<QVector2D> piece;
+		int next = 0;
+		for (int j = 0; j < polyLine.size(); j++) {
+			piece.push_back(polyLine[j]);
+
+			while (next < splits[i].size() && splits[i][next].first.first == j) {
+				const QVector2D& intPt = crossings[splits[i][next].second].pt;
+				RoadVertexDesc v_desc = crossingVertices[splits[i][next].second];
+				piece.push_back(intPt);
+
+				RoadEdge* new_e = roads->createEdge(edge->lanes, edge->type, edge->oneWay);
+				new_e->polyLine = piece;
+				roads->addEdge(prev_desc, v_desc, new_e);
+
+				piece.clear();
+				piece.push_back(intPt);
+				prev_desc = v_desc;
+				next++;
+			}
+		}
+
+		RoadEdge* new_e = roads->createEdge(edge->lanes, edge->type, edge->oneWay);
+		new_e->polyLine = piece;
+		roads->addEdge(prev_desc, lastVertices[i], new_e);
+	}
+}
+
 /**
  * 道路網をスケルトン化する。
  * 具体的には、オリジナル道路網で、degreeが1の頂点と、その隣接エッジを無効にする。
  * 注意：頂点を削除した結果、新たにdegreeが1となる頂点は、その対象ではない。
  */
 void GraphUtil::skeltonize(RoadGraph* roads) {
-	QList<RoadVertexDesc> list;
-
 	// 削除対象となる頂点リストを取得
-	RoadVertexIter vi, vend;
-	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
-		if (!roads->graph[*vi]->valid) continue;
-
-		if (getDegree(roads, *vi) == 1) {
-			list.push_back(*vi);
-		}
-	}
+	std::vector<RoadVertexDesc> list = getVerticesByDegree(roads, 1);
 
 	for (int i = 0; i < list.size(); i++) {
 		// 隣接エッジを無効にする
@@ -1586,11 +2401,11 @@ void GraphUtil::skeltonize(RoadGraph* roads) {
 		for (boost::tie(ei, eend) = boost::out_edges(list[i], roads->graph); ei != eend; ++ei) {
 			if (!roads->graph[*ei]->valid) continue;
 
-			roads->graph[*ei]->valid = false;
+			roads->setValid(*ei, false);
 		}
 
 		// 頂点を無効にする
-		roads->graph[list[i]]->valid = false;
+		roads->setValid(list[i], false);
 	}
 }
 
@@ -1603,19 +2418,24 @@ void GraphUtil::rotate(RoadGraph* roads, float theta) {
 	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
 		QVector2D pos = roads->graph[*vi]->pt;
 
-		roads->graph[*vi]->pt.setX(cosf(theta) * pos.x() - sinf(theta) * pos.y());
-		roads->graph[*vi]->pt.setY(sinf(theta) * pos.x() + cosf(theta) * pos.y());
+		RoadVertex* v = roads->detach(*vi);
+		v->pt.setX(cosf(theta) * pos.x() - sinf(theta) * pos.y());
+		v->pt.setY(sinf(theta) * pos.x() + cosf(theta) * pos.y());
 	}
+	roads->rebuildVertexIndex();
 
 	// Rotate edges
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
-		for (int i = 0; i < roads->graph[*ei]->polyLine.size(); i++) {
-			QVector2D pos = roads->graph[*ei]->polyLine[i];
-			roads->graph[*ei]->polyLine[i].setX(cosf(theta) * pos.x() - sinf(theta) * pos.y());
-			roads->graph[*ei]->polyLine[i].setY(sinf(theta) * pos.x() + cosf(theta) * pos.y());
+		RoadEdge* edge = roads->detach(*ei);
+		for (int i = 0; i < edge->polyLine.size(); i++) {
+			QVector2D pos = edge->polyLine[i];
+			edge->polyLine[i].setX(cosf(theta) * pos.x() - sinf(theta) * pos.y());
+			edge->polyLine[i].setY(sinf(theta) * pos.x() + cosf(theta) * pos.y());
 		}
+		edge->invalidateGeometry();
 	}
+	roads->rebuildSegmentIndex();
 }
 
 /**
@@ -1625,16 +2445,20 @@ void GraphUtil::translate(RoadGraph* roads, QVector2D offset) {
 	// Translate vertices
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
-		roads->graph[*vi]->pt += offset;
+		roads->detach(*vi)->pt += offset;
 	}
+	roads->rebuildVertexIndex();
 
 	// Translate edges
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
-		for (int i = 0; i < roads->graph[*ei]->polyLine.size(); i++) {
-			roads->graph[*ei]->polyLine[i] += offset;
+		RoadEdge* edge = roads->detach(*ei);
+		for (int i = 0; i < edge->polyLine.size(); i++) {
+			edge->polyLine[i] += offset;
 		}
+		edge->invalidateGeometry();
 	}
+	roads->rebuildSegmentIndex();
 }
 
 /**
@@ -1651,9 +2475,8 @@ RoadGraph* GraphUtil::convertToGridNetwork(RoadGraph* roads, RoadVertexDesc star
 	visited.push_back(start);
 
 	// スタート頂点を追加
-	RoadVertex* v = new RoadVertex(QVector2D(0, 0));
-	RoadVertexDesc v_desc = boost::add_vertex(new_roads->graph);
-	new_roads->graph[v_desc] = v;
+	RoadVertex* v = new_roads->createVertex(QVector2D(0, 0));
+	RoadVertexDesc v_desc = new_roads->addVertex(v);
 	
 	QList<RoadVertexDesc> new_queue;
 	new_queue.push_back(v_desc);
@@ -1688,9 +2511,8 @@ RoadGraph* GraphUtil::convertToGridNetwork(RoadGraph* roads, RoadVertexDesc star
 			RoadVertexDesc new_u_desc;
 			if (!getVertex(new_roads, pos, 0.0f, new_u_desc)) {
 				// 頂点を追加
-				RoadVertex* new_u = new RoadVertex(pos);
-				new_u_desc = boost::add_vertex(new_roads->graph);
-				new_roads->graph[new_u_desc] = new_u;
+				RoadVertex* new_u = new_roads->createVertex(pos);
+				new_u_desc = new_roads->addVertex(new_u);
 			}
 
 			if (!hasEdge(new_roads, new_v_desc, new_u_desc)) {
@@ -1752,9 +2574,8 @@ RoadGraph* GraphUtil::approximateToGridNetwork(RoadGraph* roads, float cellLengt
 		for (int j = 0; j < grid_desc[i].size(); j++) {
 			if (grid_weight[i][j] == 0.0f) continue;
 
-			RoadVertex* v = new RoadVertex(orig + QVector2D(cellLength, 0) * j + QVector2D(0, cellLength) * i);
-			RoadVertexDesc v_desc = boost::add_vertex(new_roads->graph);
-			new_roads->graph[v_desc] = v;
+			RoadVertex* v = new_roads->createVertex(orig + QVector2D(cellLength, 0) * j + QVector2D(0, cellLength) * i);
+			RoadVertexDesc v_desc = new_roads->addVertex(v);
 
 			conv[grid_desc[i][j]] = v_desc;
 		}
@@ -1841,7 +2662,7 @@ void GraphUtil::scaleToBBox(RoadGraph* roads, BBox& area) {
 			moveEdge(roads, *ei, pos, roads->graph[tgt]->pt);
 		}
 
-		roads->graph[*vi]->pt = pos;
+		roads->setPt(*vi, pos);
 	}
 }
 
@@ -1851,76 +2672,95 @@ void GraphUtil::scaleToBBox(RoadGraph* roads, BBox& area) {
  * まず、全エッジの平均長を計算し、これをエッジの本来の長さと仮定する。
  * 次に、各頂点について、各隣接エッジの長さの、本来長からの変形量を使って、各頂点にかかる仮想的な力を計算する。
  * 最後に、この仮想的な力に、適当なdTをかけた値を使って、各頂点を移動させる。
+ * 力は全て、反復の開始時点の頂点位置から計算し、全頂点の力を計算してから、まとめて移動させる。
  * これを、一定数、繰り返す。（終了条件について、要検討）
+ *
+ * 接続されていない頂点からの力は、Barnes-Hut法で近似する（BarnesHutTree参照）。
+ * 各頂点にかかる力は、全コアで並列に計算する。
+ *
+ * @param opening_angle	Barnes-Hut法のopening angle。0なら近似しない。
  */
-void GraphUtil::normalizeBySpring(RoadGraph* roads, BBox& area) {
+void GraphUtil::normalizeBySpring(RoadGraph* roads, BBox& area, float opening_angle) {
 	// バネの原理を使って、各エッジの長さを均等にする
 	float step = 0.03f;
 
-	//for (int i = 0; i < 1000; i++) {
-	for (int i = 0; i < 1; i++) {
+	BarnesHutTree tree(opening_angle);
+
+	for (int i = 0; i < 1000; i++) {
 		float avg_edge_length = computeAvgEdgeLength(roads);
 
+		// 有効な頂点の位置のスナップショット（indices[v]は、vのスナップショット内のインデックス。無効な頂点は-1）
+		std::vector<RoadVertexDesc> vertices;
+		std::vector<QVector2D> pts;
+		std::vector<int> indices(boost::num_vertices(roads->graph), -1);
 		RoadVertexIter vi, vend;
 		for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
 			if (!roads->graph[*vi]->valid) continue;
 
+			indices[*vi] = vertices.size();
+			vertices.push_back(*vi);
+			pts.push_back(roads->graph[*vi]->pt);
+		}
+
+		// 全頂点からの力を計算する
+		tree.build(pts);
+		std::vector<QVector2D> forces = tree.computeForces(pts, avg_edge_length);
+
+		// 全頂点の移動後の位置を、スナップショットから計算する
+		// （neighborOf[k]は、頂点kを最後に隣接頂点として数えた頂点のインデックス）
+		std::vector<QVector2D> newPts = pts;
+		std::vector<int> neighborOf(vertices.size(), -1);
+		for (int j = 0; j < vertices.size(); j++) {
+			RoadVertexDesc v = vertices[j];
+
 			// 頂点にかかる力を計算する
 			QVector2D force;
 
 			// 隣接エッジからは、引っ張られる
+			// 接続されていない頂点からの力には、隣接頂点からの力も含まれているので、差し引く
 			RoadOutEdgeIter ei, eend;
-			for (boost::tie(ei, eend) = boost::out_edges(*vi, roads->graph); ei != eend; ++ei) {
+			for (boost::tie(ei, eend) = boost::out_edges(v, roads->graph); ei != eend; ++ei) {
 				if (!roads->graph[*ei]->valid) continue;
 
-				RoadVertexDesc src = *vi;
-				RoadVertexDesc tgt = boost::target(*ei, roads->graph);
-
-				QVector2D dir = roads->graph[tgt]->pt - roads->graph[src]->pt;
-				float x = (roads->graph[tgt]->pt - roads->graph[src]->pt).length() - avg_edge_length * 1.0f;
-				
-				force += dir.normalized() * x;
-			}
-
-			// 接続されていない、近隣の頂点からは、反発力を受ける
-			RoadVertexIter vi2, vend2;
-			for (boost::tie(vi2, vend2) = boost::vertices(roads->graph); vi2 != vend2; ++vi2) {
-				if (!roads->graph[*vi2]->valid) continue;
-
-				if (hasEdge(roads, *vi, *vi2)) continue;
-
-				/*
-				QVector2D dir = roads->graph[*vi]->pt - roads->graph[*vi2]->pt;
-				float x = avg_edge_length * 1.44f - (roads->graph[*vi2]->pt - roads->graph[*vi]->pt).length();
-
-				if (x > 0.0f) {
-					force += dir.normalized() * x;
-				}*/
+				int k = indices[boost::target(*ei, roads->graph)];
+				if (k < 0) continue;
 
-				RoadVertexDesc src = *vi;
-				RoadVertexDesc tgt = *vi2;
+				force += BarnesHutTree::computeForce(pts[j], pts[k], avg_edge_length);
 
-				QVector2D dir = roads->graph[tgt]->pt - roads->graph[src]->pt;
-				float x = (roads->graph[tgt]->pt - roads->graph[src]->pt).length() - avg_edge_length * 1.0f;
-				
-				force += dir.normalized() * x * 0.02f;	// ←　この係数は、微調整が必要。。。
+				if (neighborOf[k] != j) {
+					neighborOf[k] = j;
+					forces[j] -= BarnesHutTree::computeForce(pts[j], pts[k], avg_edge_length);
+				}
 			}
 
+			// 接続されていない頂点からは、弱い力を受ける
+			force += forces[j] * 0.02f;	// ←　この係数は、微調整が必要。。。
+
 			// 移動後の位置が、指定された範囲内か、チェック
-			QVector2D pos = roads->graph[*vi]->pt + force * step;
+			QVector2D pos = pts[j] + force * step;
 			if (area.contains(pos)) {
-				// 頂点をする
-				roads->graph[*vi]->pt = pos;
+				newPts[j] = pos;
+			}
+		}
 
-				// エッジも移動する
-				for (boost::tie(ei, eend) = boost::out_edges(*vi, roads->graph); ei != eend; ++ei) {
-					if (!roads->graph[*ei]->valid) continue;
+		// エッジを移動する（moveEdgeは、頂点の移動前の位置を使うので、頂点より先に移動する）
+		RoadEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
+			if (!roads->graph[*ei]->valid) continue;
 
-					RoadVertexDesc tgt = boost::target(*ei, roads->graph);
+			int src = indices[boost::source(*ei, roads->graph)];
+			int tgt = indices[boost::target(*ei, roads->graph)];
+			if (src < 0 || tgt < 0) continue;
+			if (newPts[src] == pts[src] && newPts[tgt] == pts[tgt]) continue;
 
-					moveEdge(roads, *ei, pos, roads->graph[tgt]->pt);
-				}
-			}
+			moveEdge(roads, *ei, newPts[src], newPts[tgt]);
+		}
+
+		// 頂点を移動する
+		for (int j = 0; j < vertices.size(); j++) {
+			if (newPts[j] == pts[j]) continue;
+
+			roads->setPt(vertices[j], newPts[j]);
 		}
 	}
 }
@@ -1944,7 +2784,7 @@ bool GraphUtil::removeDuplicateEdges(RoadGraph* roads) {
 			RoadVertexDesc tgt = boost::target(*ei, roads->graph);
 
 			if (targets.contains(tgt)) {
-				roads->graph[*ei]->valid = false;
+				roads->setValid(*ei, false);
 				removed = true;
 			} else {
 				targets.push_back(tgt);
@@ -1963,6 +2803,10 @@ bool GraphUtil::removeDuplicateEdges(RoadGraph* roads) {
 void GraphUtil::snapDeadendEdges(RoadGraph* roads, float threshold) {
 	float min_angle_threshold = 0.34f;
 
+	// the vertex index is used only during this pass
+	bool vertexIndexed = roads->vertexGrid != NULL;
+	roads->enableVertexIndex(threshold);
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
 		if (!roads->graph[*vi]->valid) continue;
@@ -1982,13 +2826,12 @@ void GraphUtil::snapDeadendEdges(RoadGraph* roads, float threshold) {
 			break;
 		}
 
-		// find the closest vertex
+		// find the closest vertex among the vertices within the threshold
 		RoadVertexDesc nearest_desc;
 		float min_dist = std::numeric_limits<float>::max();
 
-		RoadVertexIter vi2, vend2;
-		for (boost::tie(vi2, vend2) = boost::vertices(roads->graph); vi2 != vend2; ++vi2) {
-			if (!roads->graph[*vi2]->valid) continue;
+		std::vector<RoadVertexDesc> candidates = getVerticesInRadius(roads, roads->graph[*vi]->pt, threshold);
+		for (std::vector<RoadVertexDesc>::iterator vi2 = candidates.begin(); vi2 != candidates.end(); ++vi2) {
 			if (*vi2 == *vi) continue;
 			if (*vi2 == tgt) continue;
 			if (GraphUtil::getDegree(roads, *vi2) == 1) continue;
@@ -2021,8 +2864,7 @@ void GraphUtil::snapDeadendEdges(RoadGraph* roads, float threshold) {
 
 		// If no such vertex exists, find the closest vertex of degree 1.
 		if (min_dist > threshold) {
-			for (boost::tie(vi2, vend2) = boost::vertices(roads->graph); vi2 != vend2; ++vi2) {
-				if (!roads->graph[*vi2]->valid) continue;
+			for (std::vector<RoadVertexDesc>::iterator vi2 = candidates.begin(); vi2 != candidates.end(); ++vi2) {
 				if (*vi2 == *vi) continue;
 				if (*vi2 == tgt) continue;
 				if (GraphUtil::getDegree(roads, *vi2) != 1) continue;
@@ -2074,20 +2916,23 @@ void GraphUtil::snapDeadendEdges(RoadGraph* roads, float threshold) {
 			if (GraphUtil::hasEdge(roads, nearest_desc, tgt, false)) {
 				// もともとエッジがあるが無効となっている場合、それを有効にし、エッジのポリラインを更新する
 				RoadEdgeDesc new_e_desc = GraphUtil::getEdge(roads, nearest_desc, tgt, false);
-				roads->graph[new_e_desc]->valid = true;
-				roads->graph[new_e_desc]->polyLine = roads->graph[e_desc]->polyLine;
+				roads->setValid(new_e_desc, true);
+				roads->detach(new_e_desc)->polyLine = roads->graph[e_desc]->polyLine;
+				roads->invalidateGeometry(new_e_desc);
 			} else {
 				// 該当頂点間にエッジがない場合は、新しいエッジを追加する
 				GraphUtil::addEdge(roads, nearest_desc, tgt, roads->graph[e_desc]);
 			}
 
 			// 古いエッジを無効にする
-			roads->graph[e_desc]->valid = false;
+			roads->setValid(e_desc, false);
 
 			// 当該頂点を無効にする
-			roads->graph[*vi]->valid = false;
+			roads->setValid(*vi, false);
 		}
 	}
+
+	if (!vertexIndexed) roads->disableVertexIndex();
 }
 
 /**
@@ -2097,6 +2942,10 @@ void GraphUtil::snapDeadendEdges(RoadGraph* roads, float threshold) {
 void GraphUtil::snapDeadendEdges2(RoadGraph* roads, int degree, float threshold) {
 	float angle_threshold = 0.34f;
 
+	// the vertex index is used only during this pass
+	bool vertexIndexed = roads->vertexGrid != NULL;
+	roads->enableVertexIndex(threshold);
+
 	RoadVertexIter vi, vend;
 	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
 		if (!roads->graph[*vi]->valid) continue;
@@ -2116,13 +2965,12 @@ void GraphUtil::snapDeadendEdges2(RoadGraph* roads, int degree, float threshold)
 			break;
 		}
 
-		// 近接頂点を探す
+		// 近接頂点を探す（threshold以内の頂点のみ）
 		RoadVertexDesc nearest_desc;
 		float min_dist = std::numeric_limits<float>::max();
 
-		RoadVertexIter vi2, vend2;
-		for (boost::tie(vi2, vend2) = boost::vertices(roads->graph); vi2 != vend2; ++vi2) {
-			if (!roads->graph[*vi2]->valid) continue;
+		std::vector<RoadVertexDesc> candidates = getVerticesInRadius(roads, roads->graph[*vi]->pt, threshold);
+		for (std::vector<RoadVertexDesc>::iterator vi2 = candidates.begin(); vi2 != candidates.end(); ++vi2) {
 			if (*vi2 == *vi) continue;
 			if (*vi2 == tgt) continue;
 
@@ -2137,6 +2985,7 @@ void GraphUtil::snapDeadendEdges2(RoadGraph* roads, int degree, float threshold)
 				min_dist = dist;
 			}
 		}
+		if (min_dist > threshold) continue;
 		
 		// 近接頂点が、*viよりもtgtの方に近い場合は、スナップしない
 		if ((roads->graph[nearest_desc]->pt - roads->graph[tgt]->pt).length() < (roads->graph[*vi]->pt - roads->graph[tgt]->pt).length()) continue;
@@ -2153,6 +3002,8 @@ void GraphUtil::snapDeadendEdges2(RoadGraph* roads, int degree, float threshold)
 			snapVertex(roads, *vi, nearest_desc);
 		}
 	}
+
+	if (!vertexIndexed) roads->disableVertexIndex();
 }
 
 /**
@@ -2180,8 +3031,8 @@ void GraphUtil::removeShortDeadend(RoadGraph* roads, float threshold) {
 
 				// invalidate the too short edge, and invalidate the dead-end vertex.
 				if (roads->graph[*ei]->getLength() < threshold) {
-					roads->graph[*vi]->valid = false;
-					roads->graph[*ei]->valid = false;
+					roads->setValid(*vi, false);
+					roads->setValid(*ei, false);
 					deleted = true;
 				}
 			}
@@ -2312,8 +3163,7 @@ float GraphUtil::computeDissimilarity(RoadGraph* roads1, QMap<RoadVertexDesc, Ro
 				RoadVertexDesc v1b = boost::target(*ei, roads1->graph);
 				RoadVertexDesc v2b = map1[v1b];
 
-				if (v2 == v2b || !isConnected(roads2, v2, v2b)) { // 対応ノード間が接続されてない場合
-				//if (v2 == v2b || !roads2->isConnected(v2, v2b)) { // キャッシュによる高速化（ただし、事前にconnectivityを計算する必要有り
+				if (v2 == v2b || !roads2->isConnected(v2, v2b)) { // 対応ノード間が接続されてない場合（キャッシュした連結成分で判定）
 					penalty += roads1->graph[*ei]->getLength() * roads1->graph[*ei]->weight * w_connectivity;
 				} else {
 					QVector2D dir1 = roads1->graph[v1b]->getPt() - roads1->graph[*vi]->getPt();
@@ -2353,8 +3203,7 @@ float GraphUtil::computeDissimilarity(RoadGraph* roads1, QMap<RoadVertexDesc, Ro
 				RoadVertexDesc v2b = boost::target(*ei, roads2->graph);
 				RoadVertexDesc v1b = map2[v2b];
 
-				if (v1 == v1b || !isConnected(roads1, v1, v1b)) { // 対応ノード間が接続されてない場合
-				//if (v1 == v1b || !roads1->isConnected(v1, v1b)) { // キャッシュによる高速化（ただし、事前にconnectivityを計算する必要有り
+				if (v1 == v1b || !roads1->isConnected(v1, v1b)) { // 対応ノード間が接続されてない場合（キャッシュした連結成分で判定）
 					penalty += roads2->graph[*ei]->getLength() * roads2->graph[*ei]->weight * w_connectivity;
 				} else {
 					QVector2D dir1 = roads1->graph[v1b]->getPt() - roads1->graph[v1]->getPt();
@@ -2508,46 +3357,79 @@ float GraphUtil::computeSimilarity(RoadGraph* roads1, QMap<RoadVertexDesc, RoadV
  * NearestNeighborに基づいて、２つの道路網のマッチングを行う。
  */
 void GraphUtil::findCorrespondenceByNearestNeighbor(RoadGraph* roads1, RoadGraph* roads2, QMap<RoadVertexDesc, RoadVertexDesc>& map1, QMap<RoadVertexDesc, RoadVertexDesc>& map2) {
+	std::vector<RoadVertexDesc> dense_map1;
+	std::vector<RoadVertexDesc> dense_map2;
+	findCorrespondenceByNearestNeighbor(roads1, roads2, dense_map1, dense_map2);
+
+	for (int i = 0; i < dense_map1.size(); i++) {
+		if (dense_map1[i] != boost::graph_traits<BGLGraph>::null_vertex()) map1[i] = dense_map1[i];
+	}
+	for (int i = 0; i < dense_map2.size(); i++) {
+		if (dense_map2[i] != boost::graph_traits<BGLGraph>::null_vertex()) map2[i] = dense_map2[i];
+	}
+}
+
+/**
+ * NearestNeighborに基づいて、２つの道路網のマッチングを行う。
+ * 結果は、頂点descriptorをindexとする配列に格納する。ペアがない頂点は、null_vertex()となる。
+ */
+void GraphUtil::findCorrespondenceByNearestNeighbor(RoadGraph* roads1, RoadGraph* roads2, std::vector<RoadVertexDesc>& map1, std::vector<RoadVertexDesc>& map2) {
+	map1.assign(boost::num_vertices(roads1->graph), boost::graph_traits<BGLGraph>::null_vertex());
+	map2.assign(boost::num_vertices(roads2->graph), boost::graph_traits<BGLGraph>::null_vertex());
+
+	// 頂点数の少ない方の道路網から、対応する頂点を探す
 	if (getNumVertices(roads1) < getNumVertices(roads2)) {
-		// 道路網１の各頂点に対して、対応する道路網２の頂点を探す
-		RoadVertexIter vi, vend;
-		for (boost::tie(vi, vend) = boost::vertices(roads1->graph); vi != vend; ++vi) {
-			if (!roads1->graph[*vi]->valid) continue;
+		findCorrespondenceByNearestNeighbor2(roads1, roads2, map1, map2);
+	} else {
+		findCorrespondenceByNearestNeighbor2(roads2, roads1, map2, map1);
+	}
+}
 
-			RoadVertexDesc v2 = getVertex(roads2, roads1->graph[*vi]->pt);
-			map1[*vi] = v2;
-			map2[v2] = *vi;
-		}
+/**
+ * 道路網１の各頂点に対して、対応する道路網２の頂点を探す。
+ * その後、道路網２の各頂点に対して、まだペアがない場合は、対応する道路網１の頂点を探す。
+ * 各道路網のk-d treeを一度だけ構築し、全頂点の最近傍をまとめて並列に求める。
+ */
+void GraphUtil::findCorrespondenceByNearestNeighbor2(RoadGraph* roads1, RoadGraph* roads2, std::vector<RoadVertexDesc>& map1, std::vector<RoadVertexDesc>& map2) {
+	KDTree tree1;
+	KDTree tree2;
+	tree1.build(roads1);
+	tree2.build(roads2);
+
+	// 道路網１の各頂点に対して、対応する道路網２の頂点を探す
+	std::vector<RoadVertexDesc> descs;
+	std::vector<QVector2D> pts;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads1->graph); vi != vend; ++vi) {
+		if (!roads1->graph[*vi]->valid) continue;
 
-		// 道路網２の各頂点に対して、まだペアがない場合は、対応する道路網１の頂点を探す
-		for (boost::tie(vi, vend) = boost::vertices(roads2->graph); vi != vend; ++vi) {
-			if (!roads2->graph[*vi]->valid) continue;
+		descs.push_back(*vi);
+		pts.push_back(roads1->graph[*vi]->pt);
+	}
 
-			if (map2.contains(*vi)) continue;
+	std::vector<RoadVertexDesc> nearests = tree2.findNearest(pts);
+	for (int i = 0; i < descs.size(); i++) {
+		if (nearests[i] == boost::graph_traits<BGLGraph>::null_vertex()) continue;
 
-			RoadVertexDesc v1 = getVertex(roads1, roads2->graph[*vi]->pt);
-			map2[*vi] = v1;
-		}
-	} else {
-		// 道路網２の各頂点に対して、対応する道路網１の頂点を探す
-		RoadVertexIter vi, vend;
-		for (boost::tie(vi, vend) = boost::vertices(roads2->graph); vi != vend; ++vi) {
-			if (!roads2->graph[*vi]->valid) continue;
+		map1[descs[i]] = nearests[i];
+		map2[nearests[i]] = descs[i];
+	}
 
-			RoadVertexDesc v1 = getVertex(roads1, roads2->graph[*vi]->pt);
-			map2[*vi] = v1;
-			map1[v1] = *vi;
-		}
+	// 道路網２の各頂点に対して、まだペアがない場合は、対応する道路網１の頂点を探す
+	descs.clear();
+	pts.clear();
+	for (boost::tie(vi, vend) = boost::vertices(roads2->graph); vi != vend; ++vi) {
+		if (!roads2->graph[*vi]->valid) continue;
 
-		// 道路網１の各頂点に対して、まだペアがない場合は、対応する道路網２の頂点を探す
-		for (boost::tie(vi, vend) = boost::vertices(roads1->graph); vi != vend; ++vi) {
-			if (!roads1->graph[*vi]->valid) continue;
+		if (map2[*vi] != boost::graph_traits<BGLGraph>::null_vertex()) continue;
 
-			if (map1.contains(*vi)) continue;
+		descs.push_back(*vi);
+		pts.push_back(roads2->graph[*vi]->pt);
+	}
 
-			RoadVertexDesc v2 = getVertex(roads2, roads1->graph[*vi]->pt);
-			map1[*vi] = v2;
-		}
+	nearests = tree1.findNearest(pts);
+	for (int i = 0; i < descs.size(); i++) {
+		map2[descs[i]] = nearests[i];
 	}
 }
 
@@ -2703,6 +3585,12 @@ void GraphUtil::findCorrespondence(RoadGraph* roads1, AbstractForest* forest1, R
 	std::list<RoadVertexDesc> seeds1;
 	std::list<RoadVertexDesc> seeds2;
 
+	// The edges between the parent and the children are looked up many times, so use the adjacency index during this pass.
+	bool indexed1 = roads1->adjacencyIndex != NULL;
+	roads1->enableAdjacencyIndex();
+	bool indexed2 = roads2->adjacencyIndex != NULL;
+	roads2->enableAdjacencyIndex();
+
 	// For each root edge
 	for (int i = 0; i < forest1->getRoots().size(); i++) {
 		RoadVertexDesc v1 = forest1->getRoots()[i];
@@ -2724,7 +3612,7 @@ void GraphUtil::findCorrespondence(RoadGraph* roads1, AbstractForest* forest1, R
 		seeds2.pop_front();
 
 		// If there is no child, skip it.
-		if (forest1->getChildren(parent1).size() == 0 && forest2->getChildren(parent2).size() == 0) continue;
+		if (forest1->getNumChildren(parent1) == 0 && forest2->getNumChildren(parent2) == 0) continue;
 
 		// retrieve the children list
 		std::vector<RoadVertexDesc> children1 = forest1->getChildren(parent1);
@@ -2744,8 +3632,8 @@ void GraphUtil::findCorrespondence(RoadGraph* roads1, AbstractForest* forest1, R
 			map2[child2] = child1;
 
 			// set fullyPaired flags
-			roads1->graph[getEdge(roads1, parent1, child1)]->fullyPaired = true;
-			roads2->graph[getEdge(roads2, parent2, child2)]->fullyPaired = true;
+			roads1->detach(getEdge(roads1, parent1, child1))->fullyPaired = true;
+			roads2->detach(getEdge(roads2, parent2, child2))->fullyPaired = true;
 
 			seeds1.push_back(child1);
 			seeds2.push_back(child2);
@@ -2766,6 +3654,9 @@ void GraphUtil::findCorrespondence(RoadGraph* roads1, AbstractForest* forest1, R
 			seeds2.push_back(child2);
 		}
 	}
+
+	if (!indexed1) roads1->disableAdjacencyIndex();
+	if (!indexed2) roads2->disableAdjacencyIndex();
 }
 
 /**
@@ -2787,18 +3678,19 @@ bool GraphUtil::forceMatching(RoadGraph* roads1, RoadVertexDesc parent1, Abstrac
 		if (!roads1->graph[children1[i]]->valid) continue;
 
 		// 相手の親ノードをコピーしてマッチさせる
-		RoadVertex* v = new RoadVertex(roads2->graph[parent2]->getPt());
-		RoadVertexDesc v_desc = boost::add_vertex(roads2->graph);
-		roads2->graph[v_desc] = v;
+		RoadVertex* v = roads2->createVertex(roads2->graph[parent2]->getPt());
+		RoadVertexDesc v_desc = roads2->addVertex(v);
 
 		RoadEdgeDesc e1_desc = GraphUtil::getEdge(roads1, parent1, children1[i]);
 
 		// 相手の親ノードと子ノードの間にエッジを作成する
 		//RoadEdgeDesc e2_desc = GraphUtil::addEdge(roads2, parent2, v_desc, roads1->graph[e1_desc]->lanes, roads1->graph[e1_desc]->type, roads1->graph[e1_desc]->oneWay);
 		RoadEdgeDesc e2_desc = GraphUtil::addEdge(roads2, parent2, v_desc, roads1->graph[e1_desc]);
-		roads2->graph[e2_desc]->polyLine.clear();
-		roads2->graph[e2_desc]->addPoint(roads2->graph[parent2]->pt);
-		roads2->graph[e2_desc]->addPoint(roads2->graph[v_desc]->pt);
+		RoadEdge* e2 = roads2->detach(e2_desc);
+		e2->polyLine.clear();
+		e2->addPoint(roads2->graph[parent2]->pt);
+		e2->addPoint(roads2->graph[v_desc]->pt);
+		roads2->invalidateGeometry(e2_desc);
 
 		forest2->addChild(parent2, v_desc);
 
@@ -2813,18 +3705,19 @@ bool GraphUtil::forceMatching(RoadGraph* roads1, RoadVertexDesc parent1, Abstrac
 		if (!roads2->graph[children2[i]]->valid) continue;
 
 		// 相手の親ノードをコピーしてマッチさせる
-		RoadVertex* v = new RoadVertex(roads1->graph[parent1]->getPt());
-		RoadVertexDesc v_desc = boost::add_vertex(roads1->graph);
-		roads1->graph[v_desc] = v;
+		RoadVertex* v = roads1->createVertex(roads1->graph[parent1]->getPt());
+		RoadVertexDesc v_desc = roads1->addVertex(v);
 
 		RoadEdgeDesc e2_desc = GraphUtil::getEdge(roads2, parent2, children2[i]);
 
 		// 相手の親ノードと子ノードの間にエッジを作成する
 		//GraphUtil::addEdge(roads1, parent1, v_desc, roads2->graph[e2_desc]->lanes, roads2->graph[e2_desc]->type, roads2->graph[e2_desc]->oneWay);
 		RoadEdgeDesc e1_desc = GraphUtil::addEdge(roads1, parent1, v_desc, roads2->graph[e2_desc]);
-		roads1->graph[e1_desc]->polyLine.clear();
-		roads1->graph[e1_desc]->addPoint(roads1->graph[parent1]->pt);
-		roads1->graph[e1_desc]->addPoint(roads1->graph[v_desc]->pt);
+		RoadEdge* e1 = roads1->detach(e1_desc);
+		e1->polyLine.clear();
+		e1->addPoint(roads1->graph[parent1]->pt);
+		e1->addPoint(roads1->graph[v_desc]->pt);
+		roads1->invalidateGeometry(e1_desc);
 
 		forest1->addChild(parent1, v_desc);
 
@@ -2999,10 +3892,12 @@ void GraphUtil::rigidICP(RoadGraph* roads1, RoadGraph* roads2, QList<EdgePair>&
 	RoadVertexIter vi, vend;
 	int count = 0;
 	for (boost::tie(vi, vend) = boost::vertices(roads1->graph); vi != vend; ++vi) {
-		roads1->graph[*vi]->pt.setX(src2.at<float>(count, 0));
-		roads1->graph[*vi]->pt.setY(src2.at<float>(count, 1));
+		RoadVertex* v = roads1->detach(*vi);
+		v->pt.setX(src2.at<float>(count, 0));
+		v->pt.setY(src2.at<float>(count, 1));
 		count++;
 	}
+	roads1->rebuildVertexIndex();
 
 	// 道路網１のエッジの座標も更新する
 	src = convertEdgesToCVMatrix(roads1, false);
@@ -3012,12 +3907,15 @@ void GraphUtil::rigidICP(RoadGraph* roads1, RoadGraph* roads2, QList<EdgePair>&
 	RoadEdgeIter ei, eend;
 	count = 0;
 	for (boost::tie(ei, eend) = boost::edges(roads1->graph); ei != eend; ++ei) {
-		for (int i = 0; i < roads1->graph[*ei]->polyLine.size(); i++) {
-			roads1->graph[*ei]->polyLine[i].setX(src2.at<float>(count, 0));
-			roads1->graph[*ei]->polyLine[i].setY(src2.at<float>(count, 1));
+		RoadEdge* edge = roads1->detach(*ei);
+		for (int i = 0; i < edge->polyLine.size(); i++) {
+			edge->polyLine[i].setX(src2.at<float>(count, 0));
+			edge->polyLine[i].setY(src2.at<float>(count, 1));
 			count++;
 		}
+		edge->invalidateGeometry();
 	}
+	roads1->rebuildSegmentIndex();
 }
 
 /**
@@ -3082,20 +3980,17 @@ RoadGraph* GraphUtil::createGridNetwork(float size, int num) {
 	// ノードを作成
 	for (int i = 0; i < num - 2; i++) {
 		for (int j = 0; j < num; j++) {
-			RoadVertex* v = new RoadVertex(orig + QVector2D(j * length, i * length + length));
-			RoadVertexDesc desc = boost::add_vertex(roads->graph);
-			roads->graph[desc] = v;
+			RoadVertex* v = roads->createVertex(orig + QVector2D(j * length, i * length + length));
+			roads->addVertex(v);
 		}
 	}
 	for (int i = 0; i < num - 2; i++) {
-		RoadVertex* v = new RoadVertex(orig + QVector2D(i * length + length, 0));
-		RoadVertexDesc desc = boost::add_vertex(roads->graph);
-		roads->graph[desc] = v;
+		RoadVertex* v = roads->createVertex(orig + QVector2D(i * length + length, 0));
+		roads->addVertex(v);
 	}
 	for (int i = 0; i < num - 2; i++) {
-		RoadVertex* v = new RoadVertex(orig + QVector2D(i * length + length, size));
-		RoadVertexDesc desc = boost::add_vertex(roads->graph);
-		roads->graph[desc] = v;
+		RoadVertex* v = roads->createVertex(orig + QVector2D(i * length + length, size));
+		roads->addVertex(v);
 	}
 
 	// エッジを作成
@@ -3140,9 +4035,8 @@ RoadGraph* GraphUtil::createCurvyNetwork(float size, int num, float angle) {
 			QVector2D pos2;
 			pos2.setX(pos.x() * cosf(angle) - pos.y() * sinf(angle));
 			pos2.setY(pos.x() * sinf(angle) + pos.y() * cosf(angle));
-			RoadVertex* v = new RoadVertex(pos2);
-			RoadVertexDesc desc = boost::add_vertex(roads->graph);
-			roads->graph[desc] = v;
+			RoadVertex* v = roads->createVertex(pos2);
+			roads->addVertex(v);
 		}
 	}
 	for (int i = 0; i < num - 2; i++) {
@@ -3150,24 +4044,22 @@ RoadGraph* GraphUtil::createCurvyNetwork(float size, int num, float angle) {
 		QVector2D pos2;
 		pos2.setX(pos.x() * cosf(angle) - pos.y() * sinf(angle));
 		pos2.setY(pos.x() * sinf(angle) + pos.y() * cosf(angle));
-		RoadVertex* v = new RoadVertex(pos2);
-		RoadVertexDesc desc = boost::add_vertex(roads->graph);
-		roads->graph[desc] = v;
+		RoadVertex* v = roads->createVertex(pos2);
+		roads->addVertex(v);
 	}
 	for (int i = 0; i < num - 2; i++) {
 		QVector2D pos = orig + QVector2D(i * length + length, size);
 		QVector2D pos2;
 		pos2.setX(pos.x() * cosf(angle) - pos.y() * sinf(angle));
 		pos2.setY(pos.x() * sinf(angle) + pos.y() * cosf(angle));
-		RoadVertex* v = new RoadVertex(pos2);
-		RoadVertexDesc desc = boost::add_vertex(roads->graph);
-		roads->graph[desc] = v;
+		RoadVertex* v = roads->createVertex(pos2);
+		roads->addVertex(v);
 	}
 
 	// エッジを作成
 	for (int i = 0; i < num - 2; i++) {
 		for (int j = 0; j < num - 1; j++) {
-			RoadEdge* e = new RoadEdge(2, 2, false);
+			RoadEdge* e = roads->createEdge(2, 2, false);
 			QVector2D pos = orig + QVector2D(j * length, i * length + length);
 			for (int k = 0; k <= 10; k++) {
 				QVector2D pos2 = pos + QVector2D((float)k * 0.1f * length, length * 0.1f * sinf((float)k * M_PI * 2 * 0.1f));
@@ -3177,13 +4069,12 @@ RoadGraph* GraphUtil::createCurvyNetwork(float size, int num, float angle) {
 				e->addPoint(pos3);
 			}
 			
-			std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(i * num + j, i * num + j + 1, roads->graph);
-			roads->graph[edge_pair.first] = e;
+			roads->addEdge(i * num + j, i * num + j + 1, e);
 		}
 	}
 	for (int i = 0; i < num - 3; i++) {
 		for (int j = 0; j < num - 2; j++) {
-			RoadEdge* e = new RoadEdge(2, 2, false);
+			RoadEdge* e = roads->createEdge(2, 2, false);
 			QVector2D pos = orig + QVector2D(j * length + length, i * length + length);
 			for (int k = 0; k <= 10; k++) {
 				QVector2D pos2 = pos + QVector2D(length * 0.1f * sinf((float)k * M_PI * 2 * 0.1f), (float)k * 0.1f * length);
@@ -3193,14 +4084,13 @@ RoadGraph* GraphUtil::createCurvyNetwork(float size, int num, float angle) {
 				e->addPoint(pos3);
 			}
 			
-			std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(i * num + 1 + j, i * num + 1 + j + num, roads->graph);
-			roads->graph[edge_pair.first] = e;
+			roads->addEdge(i * num + 1 + j, i * num + 1 + j + num, e);
 
 			//addEdge(roads, i * num + 1 + j, i * num + 1 + j + num, 2, 2);
 		}
 	}
 	for (int i = 0; i < num - 2; i++) {
-		RoadEdge* e = new RoadEdge(2, 2, false);
+		RoadEdge* e = roads->createEdge(2, 2, false);
 		QVector2D pos = orig + QVector2D(i * length + length, 0);
 		for (int k = 0; k <= 10; k++) {
 			QVector2D pos2 = pos + QVector2D(length * 0.1f * sinf((float)k * M_PI * 2 * 0.1f), (float)k * 0.1f * length);
@@ -3210,13 +4100,12 @@ RoadGraph* GraphUtil::createCurvyNetwork(float size, int num, float angle) {
 			e->addPoint(pos3);
 		}
 			
-		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(num * (num - 2) + i, i + 1, roads->graph);
-		roads->graph[edge_pair.first] = e;
+		roads->addEdge(num * (num - 2) + i, i + 1, e);
 
 		//addEdge(roads, num * (num - 2) + i, i + 1, 2, 2);
 	}
 	for (int i = 0; i < num - 2; i++) {
-		RoadEdge* e = new RoadEdge(2, 2, false);
+		RoadEdge* e = roads->createEdge(2, 2, false);
 		QVector2D pos = orig + QVector2D(i * length + length, size - length);
 		for (int k = 0; k <= 10; k++) {
 			QVector2D pos2 = pos + QVector2D(length * 0.1f * sinf((float)k * M_PI * 2 * 0.1f), (float)k * 0.1f * length);
@@ -3226,8 +4115,7 @@ RoadGraph* GraphUtil::createCurvyNetwork(float size, int num, float angle) {
 			e->addPoint(pos3);
 		}
 			
-		std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(num * (num - 2) + (num - 2) + i, num * (num - 3) + i + 1, roads->graph);
-		roads->graph[edge_pair.first] = e;
+		roads->addEdge(num * (num - 2) + (num - 2) + i, num * (num - 3) + i + 1, e);
 		
 		//addEdge(roads, num * (num - 2) + (num - 2) + i, num * (num - 3) + i + 1, 2, 2);
 	}
@@ -3248,16 +4136,14 @@ RoadGraph* GraphUtil::createRadialNetwork(float size, int num, int degree) {
 	float length = size / (float)(num + 1) / 2.0f;
 
 	// 頂点を追加
-	RoadVertex* v = new RoadVertex(QVector2D(0, 0));
-	RoadVertexDesc desc = boost::add_vertex(roads->graph);
-	roads->graph[desc] = v;
+	RoadVertex* v = roads->createVertex(QVector2D(0, 0));
+	roads->addVertex(v);
 
 	for (int i = 0; i < num + 1; i++) {
 		for (int j = 0; j < degree; j++) {
 			float theta = (float)j / (double)degree * M_PI * 2.0f;
-			RoadVertex* v = new RoadVertex(length * QVector2D((float)(i + 1) * cosf(theta), (float)(i + 1) * sinf(theta)));
-			RoadVertexDesc desc = boost::add_vertex(roads->graph);
-			roads->graph[desc] = v;
+			RoadVertex* v = roads->createVertex(length * QVector2D((float)(i + 1) * cosf(theta), (float)(i + 1) * sinf(theta)));
+			roads->addVertex(v);
 		}
 	}
 
@@ -3274,14 +4160,13 @@ RoadGraph* GraphUtil::createRadialNetwork(float size, int num, int degree) {
 		for (int j = 0; j < degree; j++) {
 			float theta = (float)j / (double)degree * M_PI * 2.0f;
 			float dt = 1.0f / (double)degree * M_PI * 2.0f;
-			RoadEdge* e = new RoadEdge(2, 2, false);
+			RoadEdge* e = roads->createEdge(2, 2, false);
 			for (int k = 0; k <= 4; k++) {
 				QVector2D pos = length * QVector2D((float)(i + 1) * cosf(theta + dt * (float)k / 4.0f), (float)(i + 1) * sinf(theta + dt * (float)k / 4.0f));
 				e->addPoint(pos);
 			}
 			
-			std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(1 + i * degree + j, 1 + i * degree + (j + 1) % degree, roads->graph);
-			roads->graph[edge_pair.first] = e;
+			roads->addEdge(1 + i * degree + j, 1 + i * degree + (j + 1) % degree, e);
 			
 			//addEdge(roads, 1 + i * 12 + j, 1 + i * 12 + (j + 1) % 12, 2, 2);
 		}
@@ -28,6 +28,53 @@ public:
 	bool operator()(const EdgePair& left, const EdgePair& right) const;
 };
 
+/**
+ * Crossing of two edges found by the planarification.
+ * The edges are specified by the indices of the list of the edges to be planarified, and edge1 < edge2.
+ */
+class EdgeCrossing {
+public:
+	int edge1;
+	int segment1;	// the index of the segment of the polyline of edge1
+	float t1;		// the position on the segment of edge1 [0, 1]
+	int edge2;
+	int segment2;
+	float t2;
+	QVector2D pt;
+
+public:
+	EdgeCrossing(int edge1, int segment1, float t1, int edge2, int segment2, float t2, const QVector2D& pt);
+	bool operator<(const EdgeCrossing& other) const;
+};
+
+/**
+ * Tile of the bounding box of the road graph used by the parallel planarification.
+ * The tile consists of the cells of the grid used to find the crossings. It has the segments
+ * whose bounding boxes overlap with it, and collects the crossings located in it.
+ */
+class EdgeCrossingTile {
+public:
+	RoadGraph* roads;
+	const std::vector<RoadEdgeDesc>* edges;
+	const std::vector<std::pair<int, int> >* segments;	// (index of the edge, index of the segment of its polyline)
+	float cellSize;
+	int originCellX;		// the first cell of the first tile
+	int originCellY;
+	int tileCellsX;			// the number of the cells of a tile in each direction
+	int tileCellsY;
+	int numTiles;			// the number of the tiles in each direction
+	int tileX;
+	int tileY;
+	std::vector<int> segmentIds;
+	std::vector<EdgeCrossing> crossings;
+
+public:
+	EdgeCrossingTile();
+	void getCellRange(int segmentId, int& cx0, int& cx1, int& cy0, int& cy1) const;
+	int toTileX(int cx) const;
+	int toTileY(int cy) const;
+};
+
 class GraphUtil {
 protected:
 	GraphUtil() {}
@@ -40,12 +87,15 @@ public:
 	static RoadVertexDesc getVertex(RoadGraph* roads, QVector2D pt, bool onlyValidVertex = true);
 	static bool getVertex(RoadGraph* roads, QVector2D pos, float threshold, RoadVertexDesc& desc, bool onlyValidVertex = true);
 	static bool getVertex(RoadGraph* roads, QVector2D pos, float threshold, RoadVertexDesc ignore, RoadVertexDesc& desc, bool onlyValidVertex = true);
+	static std::vector<RoadVertexDesc> getVerticesInRadius(RoadGraph* roads, const QVector2D& pos, float radius, bool onlyValidVertex = true);
+	static std::vector<RoadVertexDesc> getNearestVertices(RoadGraph* roads, const QVector2D& pos, int k, bool onlyValidVertex = true);
 	static int getVertexIndex(RoadGraph* roads, RoadVertexDesc desc, bool onlyValidVertex = true);
 	static RoadVertexDesc addVertex(RoadGraph* roads, RoadVertex* v);
 	static void moveVertex(RoadGraph* roads, RoadVertexDesc v, QVector2D pt);
 	static void collapseVertex(RoadGraph* roads, RoadVertexDesc v1, RoadVertexDesc v2);
 	static int getDegree(RoadGraph* roads, RoadVertexDesc v, bool onlyValidEdge = true);
 	static std::vector<RoadVertexDesc> getVertices(RoadGraph* roads, bool onlyValidVertex = true);
+	static std::vector<RoadVertexDesc> getVerticesByDegree(RoadGraph* roads, int degree, bool onlyValidVertex = true);
 	static void removeIsolatedVertices(RoadGraph* roads, bool onlyValidVertex = true);
 	static void snapVertex(RoadGraph* roads, RoadVertexDesc v1, RoadVertexDesc v2);
 	static RoadVertexDesc getCentralVertex(RoadGraph* roads);
@@ -55,6 +105,7 @@ public:
 	static float getTotalEdgeLength(RoadGraph* roads, RoadVertexDesc v);
 	static void collapseEdge(RoadGraph* roads, RoadEdgeDesc e);
 	static int getNumEdges(RoadGraph* roads, bool onlyValidEdge = true);
+	static int getNumEdgesByType(RoadGraph* roads, unsigned int type);
 	static RoadEdgeDesc addEdge(RoadGraph* roads, RoadVertexDesc src, RoadVertexDesc tgt, unsigned int lanes, unsigned int type, bool oneWay = false);
 	static RoadEdgeDesc addEdge(RoadGraph* roads, RoadVertexDesc src, RoadVertexDesc tgt, RoadEdge* ref_edge);
 	static bool hasEdge(RoadGraph* roads, RoadVertexDesc desc1, RoadVertexDesc desc2, bool onlyValidEdge = true);
@@ -63,7 +114,8 @@ public:
 	static void orderPolyLine(RoadGraph* roads, RoadEdgeDesc e, RoadVertexDesc src);
 	static void moveEdge(RoadGraph* roads, RoadEdgeDesc e, QVector2D& src_pos, QVector2D& tgt_pos);
 	static std::vector<RoadEdgeDesc> getMajorEdges(RoadGraph* roads, int num);
-	static bool removeDeadEnd(RoadGraph* roads);
+	static std::vector<RoadVertexDesc> removeDeadEnd(RoadGraph* roads);
+	static std::vector<bool> getTwoCore(RoadGraph* roads);
 	static std::vector<QVector2D> interpolateEdges(RoadGraph* roads1, RoadEdgeDesc e1, RoadVertexDesc src1, RoadGraph* roads2, RoadEdgeDesc e2, RoadVertexDesc src2, float t);
 	static void computeImportanceOfEdges(RoadGraph* roads, float w_length, float w_valence, float w_lanes);
 	static float computeDissimilarityOfEdges(RoadGraph* roads1, RoadEdgeDesc e1, RoadGraph* roads2, RoadEdgeDesc e2);
@@ -71,10 +123,14 @@ public:
 
 	// The entire graph related functions
 	static RoadGraph* copyRoads(RoadGraph* roads);
+	static RoadGraph* createSnapshot(RoadGraph* roads);
 	static void copyRoads(RoadGraph* roads1, RoadGraph* roads2);
 	static void mergeRoads(RoadGraph* roads1, RoadGraph* roads2);
 	static BBox getAABoundingBox(RoadGraph* roads);
 	static BBox getBoudingBox(RoadGraph* roads, float theta1, float theta2, float theta_step = 0.087f);
+	static BBox getBoudingBox(RoadGraph* roads, float& theta);
+	static BBox getMinAreaBoundingBox(const std::vector<QVector2D>& hull, float theta1, float theta2, float& theta);
+	static BBox getAABoundingBox(const std::vector<QVector2D>& pts, float theta);
 	static RoadGraph* extractMajorRoad(RoadGraph* roads, bool remove = true);
 	static float extractMajorRoad(RoadGraph* roads, RoadEdgeDesc root, QList<RoadEdgeDesc>& path);
 
@@ -85,23 +141,29 @@ public:
 	static RoadVertexDesc findConnectedNearestNeighbor(RoadGraph* roads, const QVector2D &pt, RoadVertexDesc v);
 	static bool getEdge(RoadGraph* roads, const QVector2D &pt, float threshold, RoadEdgeDesc& e, bool onlyValidEdge = true);
 	static RoadEdgeDesc findNearestEdge(RoadGraph* roads, RoadVertexDesc v, float& dist, QVector2D& closestPt, bool onlyValidEdge = true);
+	static std::vector<RoadEdgeDesc> getEdgesInRadius(RoadGraph* roads, const QVector2D& pt, float radius, RoadVertexDesc ignore, bool onlyValidEdge = true);
+	static std::vector<RoadEdgeDesc> getEdgesInRect(RoadGraph* roads, const BBox& rect, bool onlyValidEdge = true);
 
 	// The road graph modification functions
-	static void clean(RoadGraph* roads);
+	static std::vector<RoadVertexDesc> clean(RoadGraph* roads);
 	static void reduce(RoadGraph* roads);
 	static bool reduce(RoadGraph* roads, RoadVertexDesc desc);
+	static RoadEdgeDesc reduceChain(RoadGraph* roads, const std::vector<RoadVertexDesc>& chain, const std::vector<RoadEdgeDesc>& edges);
 	static void simplify(RoadGraph* roads, float dist_threshold);
 	static void normalize(RoadGraph* roads);
-	static void singlify(RoadGraph* roads);
-	static void planarify(RoadGraph* roads);
+	static std::vector<RoadVertexDesc> singlify(RoadGraph* roads);
+	static void planarify(RoadGraph* roads, bool parallel = false);
 	static bool planarifyOne(RoadGraph* roads);
+	static std::vector<EdgeCrossing> findEdgeCrossings(RoadGraph* roads, const std::vector<RoadEdgeDesc>& edges, bool parallel = false);
+	static void findEdgeCrossingsInTile(EdgeCrossingTile& tile);
+	static void splitEdgesAtCrossings(RoadGraph* roads, const std::vector<RoadEdgeDesc>& edges, std::vector<EdgeCrossing>& crossings);
 	static void skeltonize(RoadGraph* roads);
 	static void rotate(RoadGraph* roads, float theta);
 	static void translate(RoadGraph* roads, QVector2D offset);
 	static RoadGraph* convertToGridNetwork(RoadGraph* roads, RoadVertexDesc start);
 	static RoadGraph* approximateToGridNetwork(RoadGraph* roads, float cellLength, QVector2D orig);
 	static void scaleToBBox(RoadGraph* roads, BBox& area);
-	static void normalizeBySpring(RoadGraph* roads, BBox& area);
+	static void normalizeBySpring(RoadGraph* roads, BBox& area, float opening_angle = 0.5f);
 	static bool removeDuplicateEdges(RoadGraph* roads);
 	static void snapDeadendEdges(RoadGraph* roads, float threshold);
 	static void snapDeadendEdges2(RoadGraph* roads, int degree, float threshold);
@@ -118,6 +180,8 @@ public:
 	static float computeDissimilarity2(RoadGraph* roads1, QMap<RoadVertexDesc, RoadVertexDesc>& map1, RoadGraph* roads2, QMap<RoadVertexDesc, RoadVertexDesc>& map2, float w_matching, float w_split, float w_angle, float w_distance);
 	static float computeSimilarity(RoadGraph* roads1, QMap<RoadVertexDesc, RoadVertexDesc>& map1, RoadGraph* roads2, QMap<RoadVertexDesc, RoadVertexDesc>& map2, float w_connectivity, float w_angle);
 	static void findCorrespondenceByNearestNeighbor(RoadGraph* roads1, RoadGraph* roads2, QMap<RoadVertexDesc, RoadVertexDesc>& map1, QMap<RoadVertexDesc, RoadVertexDesc>& map2);
+	static void findCorrespondenceByNearestNeighbor(RoadGraph* roads1, RoadGraph* roads2, std::vector<RoadVertexDesc>& map1, std::vector<RoadVertexDesc>& map2);
+	static void findCorrespondenceByNearestNeighbor2(RoadGraph* roads1, RoadGraph* roads2, std::vector<RoadVertexDesc>& map1, std::vector<RoadVertexDesc>& map2);
 	static QMap<RoadVertexDesc, RoadVertexDesc> findCorrespondentEdges(RoadGraph* roads1, RoadVertexDesc parent1, std::vector<RoadVertexDesc> children1, RoadGraph* roads2, RoadVertexDesc parent2, std::vector<RoadVertexDesc> children2);
 	static QMap<RoadVertexDesc, RoadVertexDesc> findApproximateCorrespondentEdges(RoadGraph* roads1, RoadVertexDesc parent1, std::vector<RoadVertexDesc> children1, RoadGraph* roads2, RoadVertexDesc parent2, std::vector<RoadVertexDesc> children2);
 	static void findCorrespondence(RoadGraph* roads1, AbstractForest* forest1, RoadGraph* roads2, AbstractForest* forest2, bool findAllMatching, float threshold_angle, QMap<RoadVertexDesc, RoadVertexDesc>& map1, QMap<RoadVertexDesc, RoadVertexDesc>& map2);
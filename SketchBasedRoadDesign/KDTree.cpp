@@ -0,0 +1,163 @@
+#include "KDTree.h"
+#include <QtConcurrentMap>
+#include <QThread>
+#include <limits>
+#include <algorithm>
+#include <math.h>
+
+/**
+ * Order of the points along the axis. The ties are broken by the index so that the tree does not depend on the sort algorithm.
+ */
+class KDTreeAxisComparison {
+public:
+	const std::vector<QVector2D>* pts;
+	int axis;
+
+public:
+	KDTreeAxisComparison(const std::vector<QVector2D>* pts, int axis) : pts(pts), axis(axis) {}
+	bool operator()(int left, int right) const {
+		float c1 = axis == 0 ? (*pts)[left].x() : (*pts)[left].y();
+		float c2 = axis == 0 ? (*pts)[right].x() : (*pts)[right].y();
+		if (c1 != c2) return c1 < c2;
+		return left < right;
+	}
+};
+
+KDTree::KDTree() {
+}
+
+KDTree::~KDTree() {
+}
+
+/**
+ * Build the tree of the vertices of the road graph from scratch.
+ */
+void KDTree::build(RoadGraph* roads, bool onlyValidVertex) {
+	pts.clear();
+	descs.clear();
+
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		if (onlyValidVertex && !roads->graph[*vi]->valid) continue;
+
+		pts.push_back(roads->graph[*vi]->pt);
+		descs.push_back(*vi);
+	}
+
+	axes.assign(pts.size(), 0);
+	build(0, pts.size());
+}
+
+int KDTree::size() const {
+	return pts.size();
+}
+
+/**
+ * Return the closest vertex from the specified point.
+ * If there are more than one vertex at the same distance, the one with the smallest descriptor is returned
+ * so that the result is the same as the linear search (see GraphUtil::getVertex).
+ * If the tree is empty, null_vertex() is returned.
+ */
+RoadVertexDesc KDTree::findNearest(const QVector2D& pt) const {
+	int nearest = -1;
+	float min_dist = std::numeric_limits<float>::max();
+	findNearest(0, pts.size(), pt, nearest, min_dist);
+
+	if (nearest < 0) return boost::graph_traits<BGLGraph>::null_vertex();
+	else return descs[nearest];
+}
+
+/**
+ * Return the closest vertex from each of the specified points.
+ * The points are split into blocks, which are processed on all the cores.
+ */
+std::vector<RoadVertexDesc> KDTree::findNearest(const std::vector<QVector2D>& pts) const {
+	std::vector<RoadVertexDesc> results(pts.size());
+
+	int numBlocks = std::min((int)pts.size(), QThread::idealThreadCount() * 4);
+	std::vector<Block> blocks(numBlocks);
+	for (int i = 0; i < numBlocks; i++) {
+		blocks[i].tree = this;
+		blocks[i].pts = &pts;
+		blocks[i].results = &results;
+		blocks[i].start = pts.size() * i / numBlocks;
+		blocks[i].end = pts.size() * (i + 1) / numBlocks;
+	}
+
+	QtConcurrent::blockingMap(blocks, findNearestInBlock);
+
+	return results;
+}
+
+/**
+ * Build the subtree of the range [start, end) by splitting it at the median along the axis of the larger extent.
+ */
+void KDTree::build(int start, int end) {
+	if (end - start <= 1) return;
+
+	float minX = std::numeric_limits<float>::max();
+	float maxX = -std::numeric_limits<float>::max();
+	float minY = std::numeric_limits<float>::max();
+	float maxY = -std::numeric_limits<float>::max();
+	for (int i = start; i < end; i++) {
+		minX = std::min(minX, pts[i].x());
+		maxX = std::max(maxX, pts[i].x());
+		minY = std::min(minY, pts[i].y());
+		maxY = std::max(maxY, pts[i].y());
+	}
+	int axis = (maxX - minX >= maxY - minY) ? 0 : 1;
+
+	// sort the indices of the range up to the median, and reorder the points accordingly
+	std::vector<int> order;
+	for (int i = start; i < end; i++) {
+		order.push_back(i);
+	}
+	int mid = (start + end) / 2;
+	std::nth_element(order.begin(), order.begin() + (mid - start), order.end(), KDTreeAxisComparison(&pts, axis));
+
+	std::vector<QVector2D> sortedPts;
+	std::vector<RoadVertexDesc> sortedDescs;
+	for (int i = 0; i < order.size(); i++) {
+		sortedPts.push_back(pts[order[i]]);
+		sortedDescs.push_back(descs[order[i]]);
+	}
+	std::copy(sortedPts.begin(), sortedPts.end(), pts.begin() + start);
+	std::copy(sortedDescs.begin(), sortedDescs.end(), descs.begin() + start);
+
+	axes[mid] = axis;
+	build(start, mid);
+	build(mid + 1, end);
+}
+
+/**
+ * Update the closest point in the subtree of the range [start, end).
+ */
+void KDTree::findNearest(int start, int end, const QVector2D& pt, int& nearest, float& min_dist) const {
+	if (start >= end) return;
+
+	int mid = (start + end) / 2;
+	float dist = (pts[mid] - pt).length();
+	if (dist < min_dist || (dist == min_dist && nearest >= 0 && descs[mid] < descs[nearest])) {
+		nearest = mid;
+		min_dist = dist;
+	}
+
+	if (end - start == 1) return;
+
+	// visit the side of the point first, and the other side only if it can have a closer point
+	float diff = axes[mid] == 0 ? pt.x() - pts[mid].x() : pt.y() - pts[mid].y();
+	if (diff < 0) {
+		findNearest(start, mid, pt, nearest, min_dist);
+		if (-diff <= min_dist) findNearest(mid + 1, end, pt, nearest, min_dist);
+	} else {
+		findNearest(mid + 1, end, pt, nearest, min_dist);
+		if (diff <= min_dist) findNearest(start, mid, pt, nearest, min_dist);
+	}
+}
+
+void KDTree::findNearestInBlock(Block& block) {
+	for (int i = block.start; i < block.end; i++) {
+		(*block.results)[i] = block.tree->findNearest((*block.pts)[i]);
+	}
+}
+
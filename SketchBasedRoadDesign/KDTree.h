@@ -0,0 +1,44 @@
+#pragma once
+
+#include "RoadGraph.h"
+#include <qvector2d.h>
+#include <vector>
+
+/**
+ * Static 2D k-d tree of the vertex positions for the bulk nearest neighbor queries.
+ * Unlike VertexGrid, the tree is not updated when the road graph is changed, so it has to be built again.
+ * The tree is stored as an array in which each subtree occupies a contiguous range and its root is at the middle.
+ */
+class KDTree {
+private:
+	/**
+	 * The range of the query points processed by a thread.
+	 */
+	class Block {
+	public:
+		const KDTree* tree;
+		const std::vector<QVector2D>* pts;
+		std::vector<RoadVertexDesc>* results;
+		int start;
+		int end;
+	};
+
+	std::vector<QVector2D> pts;
+	std::vector<RoadVertexDesc> descs;
+	std::vector<unsigned char> axes;	// the axis (0: X, 1: Y) by which each subtree is split
+
+public:
+	KDTree();
+	~KDTree();
+
+	void build(RoadGraph* roads, bool onlyValidVertex = true);
+	int size() const;
+	RoadVertexDesc findNearest(const QVector2D& pt) const;
+	std::vector<RoadVertexDesc> findNearest(const std::vector<QVector2D>& pts) const;
+
+private:
+	void build(int start, int end);
+	void findNearest(int start, int end, const QVector2D& pt, int& nearest, float& min_dist) const;
+	static void findNearestInBlock(Block& block);
+};
+
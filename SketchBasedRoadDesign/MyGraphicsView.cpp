@@ -33,16 +33,15 @@ RoadGraph* MyGraphicsView::sketchToRoads() {
 
 		if (line->points.size() < 2) continue;
 
-		RoadVertex* v1 = new RoadVertex(line->points[0]);
-		RoadVertexDesc v1_desc = boost::add_vertex(roads->graph);
-		roads->graph[v1_desc] = v1;
+		RoadVertex* v1 = roads->createVertex(line->points[0]);
+		RoadVertexDesc v1_desc = roads->addVertex(v1);
 
-		RoadVertex* v2 = new RoadVertex(line->points[line->points.size() - 1]);
-		RoadVertexDesc v2_desc = boost::add_vertex(roads->graph);
-		roads->graph[v2_desc] = v2;
+		RoadVertex* v2 = roads->createVertex(line->points[line->points.size() - 1]);
+		RoadVertexDesc v2_desc = roads->addVertex(v2);
 
 		RoadEdgeDesc e_desc = GraphUtil::addEdge(roads, v1_desc, v2_desc, 2, 2, false);
 		roads->graph[e_desc]->polyLine = line->points;
+		roads->invalidateGeometry(e_desc);
 	}
 
 	GraphUtil::planarify(roads);
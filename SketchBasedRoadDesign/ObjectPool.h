@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+
+/**
+ * Slab allocator for the objects of the same type.
+ * The memory is allocated by a slab which contains slabSize objects, and the released objects are reused through the free list.
+ * clear() frees all the slabs at once without calling the destructors, so the objects which own any resources
+ * have to be destructed before that.
+ *
+ * Usage:
+ *     T* obj = new (pool.allocate()) T(...);
+ *     pool.release(obj);
+ */
+template <class T>
+class ObjectPool {
+private:
+	std::vector<char*> slabs;
+	std::vector<T*> freeList;
+	int slabSize;
+	int used;			// the number of objects allocated from the last slab
+
+public:
+	ObjectPool(int slabSize = 1024);
+	~ObjectPool();
+
+	void* allocate();
+	void release(T* obj);
+	void clear();
+
+private:
+	ObjectPool(const ObjectPool& ref);
+	ObjectPool& operator=(const ObjectPool& ref);
+};
+
+template<class T>
+ObjectPool<T>::ObjectPool(int slabSize) {
+	this->slabSize = slabSize;
+	this->used = slabSize;
+}
+
+template<class T>
+ObjectPool<T>::~ObjectPool() {
+	clear();
+}
+
+/**
+ * Return the memory for one object. The object has to be constructed by the placement new.
+ */
+template<class T>
+void* ObjectPool<T>::allocate() {
+	if (!freeList.empty()) {
+		T* obj = freeList.back();
+		freeList.pop_back();
+		return obj;
+	}
+
+	if (used == slabSize) {
+		slabs.push_back(new char[sizeof(T) * slabSize]);
+		used = 0;
+	}
+
+	return slabs.back() + sizeof(T) * used++;
+}
+
+/**
+ * Destruct the object, and keep its memory for the later allocation.
+ */
+template<class T>
+void ObjectPool<T>::release(T* obj) {
+	obj->~T();
+	freeList.push_back(obj);
+}
+
+/**
+ * Free all the memory at once.
+ * Note: The destructors of the remaining objects are not called.
+ */
+template<class T>
+void ObjectPool<T>::clear() {
+	for (int i = 0; i < slabs.size(); i++) {
+		delete [] slabs[i];
+	}
+	slabs.clear();
+	freeList.clear();
+	used = slabSize;
+}
+
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <qvector2d.h>
+#include <vector>
+
+/**
+ * Non-owning view of the points of a polyline.
+ * If reversed is true, the points are accessed from the last one, so that the polyline can be traversed
+ * in the opposite direction without copying or reordering it.
+ * Note: The view is invalidated when the underlying polyline is modified.
+ */
+class PolyLineView {
+public:
+	const QVector2D* data;
+	int count;
+	bool reversed;
+
+public:
+	PolyLineView() : data(NULL), count(0), reversed(false) {}
+	PolyLineView(const std::vector<QVector2D>& polyLine, bool reversed = false) : data(polyLine.empty() ? NULL : &polyLine[0]), count(polyLine.size()), reversed(reversed) {}
+	~PolyLineView() {}
+
+	inline int size() const {
+		return count;
+	}
+
+	inline bool empty() const {
+		return count == 0;
+	}
+
+	inline const QVector2D& operator[](int index) const {
+		return reversed ? data[count - 1 - index] : data[index];
+	}
+
+	inline const QVector2D& front() const {
+		return (*this)[0];
+	}
+
+	inline const QVector2D& back() const {
+		return (*this)[count - 1];
+	}
+};
+
@@ -4,6 +4,7 @@
 #include "BFSTree.h"
 #include <qmap.h>
 #include <QMouseEvent>
+#include <QResizeEvent>
 #include <QLineF>
 #include <QGraphicsSimpleTextItem>
 #include <qdebug.h>
@@ -64,8 +65,9 @@ void RoadCanvas::openRoad(const char* filename) {
 }
 
 float RoadCanvas::showSimilarity(RoadGraph* roads2) {
-	RoadGraph* r1 = GraphUtil::copyRoads(roads);
-	RoadGraph* r2 = GraphUtil::copyRoads(roads2);
+	// The matching only marks the paired edges, so the snapshots are enough.
+	RoadGraph* r1 = GraphUtil::createSnapshot(roads);
+	RoadGraph* r2 = GraphUtil::createSnapshot(roads2);
 
 	// Compute the importance of each edge
 	//GraphUtil::computeImportanceOfEdges(r1, 1.0f, 1.0f, 1.0f);
@@ -111,20 +113,45 @@ float RoadCanvas::showSimilarity(RoadGraph* roads2) {
  */
 void RoadCanvas::updateView() {
 	scene->clear();
+	roadItems.clear();
+	visibleRoads.clear();
 
-	drawFancyRoads(roads);
+	updateVisibleRoads();
 	drawSimpleRoads(sketch);
+
+	scene->update();
+}
+
+/**
+ * Show the fancy roads which come into the view, and hide the ones which go out of the view.
+ * The items of the roads are created when they come into the view for the first time, and reused after that.
+ */
+void RoadCanvas::updateVisibleRoads() {
+	QSet<RoadEdge*> visible;
+	drawFancyRoads(roads, visible);
 	if (ref_roads != NULL) {
-		drawFancyRoads(ref_roads);
+		drawFancyRoads(ref_roads, visible);
 	}
 
-	scene->update();
+	for (QSet<RoadEdge*>::iterator it = visibleRoads.begin(); it != visibleRoads.end(); ++it) {
+		if (visible.contains(*it)) continue;
+
+		QList<QGraphicsItem*>& items = roadItems[*it];
+		for (int i = 0; i < items.size(); i++) {
+			items[i]->setVisible(false);
+		}
+	}
+
+	visibleRoads = visible;
 }
 
 /**
  * Draw the fancy roads based on the specified road graph.
+ * Only the roads in the view are drawn, and the ones already shown are left as they are.
+ *
+ * @param visible	the roads in the view are added to this set
  */
-void RoadCanvas::drawFancyRoads(RoadGraph* roads) {
+void RoadCanvas::drawFancyRoads(RoadGraph* roads, QSet<RoadEdge*>& visible) {
 	// define the road width base
 	float widthBase = 10.0f;
 	float border = 4.0f;
@@ -133,17 +160,31 @@ void RoadCanvas::drawFancyRoads(RoadGraph* roads) {
 		border = 7.0f;
 	}
 
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
-		if (!roads->graph[*ei]->valid) continue;
-		//if (roads->graph[*ei]->type != 2) continue;
+	// only the visible edges are drawn. The margin covers the width of the roads.
+	roads->enableSegmentIndex();
+	std::vector<RoadEdgeDesc> edges = GraphUtil::getEdgesInRect(roads, getViewArea((widthBase + border) * 2.0f));
 
-		RoadVertexDesc src = boost::source(*ei, roads->graph);
-		RoadVertexDesc tgt = boost::target(*ei, roads->graph);
+	for (int i = 0; i < edges.size(); i++) {
+		RoadEdgeDesc e = edges[i];
+		//if (roads->graph[e]->type != 2) continue;
+
+		RoadEdge* edge = roads->graph[e];
+		visible.insert(edge);
+		if (visibleRoads.contains(edge)) continue;
+
+		// show the items if they have been created already
+		QHash<RoadEdge*, QList<QGraphicsItem*> >::iterator it = roadItems.find(edge);
+		if (it != roadItems.end()) {
+			for (int j = 0; j < it.value().size(); j++) {
+				it.value()[j]->setVisible(true);
+			}
+			continue;
+		}
+		QList<QGraphicsItem*>& items = roadItems[edge];
 
 		// define the color
 		QColor color, borderColor;
-		switch (roads->graph[*ei]->type) {
+		switch (roads->graph[e]->type) {
 		case 3:	// high way
 			color = QColor(255, 225, 104);
 			borderColor = QColor(229, 153, 21);
@@ -155,11 +196,11 @@ void RoadCanvas::drawFancyRoads(RoadGraph* roads) {
 			break;
 		}
 		
-		if (zoom < 0.1f && roads->graph[*ei]->type == 1) {
-			drawEdge(roads, *ei, widthBase * 0.5f, 0.0f, 0.0f, borderColor);
+		if (zoom < 0.1f && roads->graph[e]->type == 1) {
+			items.push_back(drawEdge(roads, e, widthBase * 0.5f, 0.0f, 0.0f, borderColor));
 		} else {
-			drawEdge(roads, *ei, widthBase + border, 0.0f, 0.0f, borderColor);
-			drawEdge(roads, *ei, widthBase, 1.0f, 0.5f, color);
+			items.push_back(drawEdge(roads, e, widthBase + border, 0.0f, 0.0f, borderColor));
+			items.push_back(drawEdge(roads, e, widthBase, 1.0f, 0.5f, color));
 		}
 	}
 
@@ -188,7 +229,7 @@ void RoadCanvas::drawSimpleRoads(RoadGraph* roads) {
 	//scene->addRect(roads->graph[v1]->pt.x() + 4900, roads->graph[v1]->pt.y() + 4900, 200, 200, QPen(Qt::blue));
 }
 
-void RoadCanvas::drawEdge(RoadGraph* roads, RoadEdgeDesc edge, float roadWidthBase, float highwayZ, float avenueZ, const QColor& color) {
+QGraphicsPathItem* RoadCanvas::drawEdge(RoadGraph* roads, RoadEdgeDesc edge, float roadWidthBase, float highwayZ, float avenueZ, const QColor& color) {
 	QPen pen(color);
 	QBrush brush(color);
 
@@ -245,6 +286,8 @@ void RoadCanvas::drawEdge(RoadGraph* roads, RoadEdgeDesc edge, float roadWidthBa
 		item->setZValue(z);
 	}
 	*/
+
+	return item;
 }
 
 void RoadCanvas::setZoom(float factor) {
@@ -274,6 +317,23 @@ QVector2D RoadCanvas::sceneToModel(const QPointF& pt) {
 	return ret;
 }
 
+/**
+ * Return the area of the road graph visible in the view.
+ *
+ * @param margin	the area is expanded by this margin
+ */
+BBox RoadCanvas::getViewArea(float margin) {
+	QRectF rect = mapToScene(viewport()->rect()).boundingRect();
+
+	BBox area;
+	area.addPoint(sceneToModel(rect.topLeft()));
+	area.addPoint(sceneToModel(rect.bottomRight()));
+	area.minPt -= QVector2D(margin, margin);
+	area.maxPt += QVector2D(margin, margin);
+
+	return area;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 // Event Handlers
 
@@ -285,15 +345,13 @@ void RoadCanvas::mousePressEvent(QMouseEvent* e) {
 			RoadVertexDesc v1_desc;
 			if (!GraphUtil::getVertex(sketch, pos, snapThreshold / zoom, v1_desc)) {
 				// If there is a vertex close to the point, don't add new vertex. Otherwise, add a new vertex.
-				RoadVertex* v1 = new RoadVertex(pos);
-				v1_desc = boost::add_vertex(sketch->graph);
-				sketch->graph[v1_desc] = v1;
+				RoadVertex* v1 = sketch->createVertex(pos);
+				v1_desc = sketch->addVertex(v1);
 			}
 
 			// add the 2nd vertex of a line
-			RoadVertex* v2 = new RoadVertex(pos);
-			RoadVertexDesc v2_desc = boost::add_vertex(sketch->graph);
-			sketch->graph[v2_desc] = v2;
+			RoadVertex* v2 = sketch->createVertex(pos);
+			RoadVertexDesc v2_desc = sketch->addVertex(v2);
 
 			sketch->curVertex = v2_desc;
 
@@ -316,15 +374,18 @@ void RoadCanvas::mouseReleaseEvent(QMouseEvent* e) {
 			GraphUtil::snapVertex(sketch, sketch->curVertex, v2_desc);
 
 			// If the length of the line is 0, remove it.
-			if (sketch->graph[sketch->curEdge]->getLength() == 0.0f) {
+			if (sketch->curEdge != RoadEdgeDesc() && sketch->graph[sketch->curEdge]->getLength() == 0.0f) {
 				RoadVertexDesc src = boost::source(sketch->curEdge, sketch->graph);
 				RoadVertexDesc tgt = boost::target(sketch->curEdge, sketch->graph);
 
-				sketch->graph[src]->valid = false;
-				sketch->graph[tgt]->valid = false;
-				sketch->graph[sketch->curEdge]->valid = false;
+				sketch->setValid(src, false);
+				sketch->setValid(tgt, false);
+				sketch->setValid(sketch->curEdge, false);
 			}
 		}
+
+		// discard the vertices and edges invalidated by the snapping
+		sketch->clean();
 	}
 
 	updateView();
@@ -340,3 +401,18 @@ void RoadCanvas::mouseMoveEvent(QMouseEvent* e) {
 
 	updateView();
 }
+
+/**
+ * Since only the visible roads are drawn, the roads which come into or go out of the view have to be shown or hidden when it is scrolled.
+ */
+void RoadCanvas::scrollContentsBy(int dx, int dy) {
+	QGraphicsView::scrollContentsBy(dx, dy);
+
+	if (isVisible()) updateVisibleRoads();
+}
+
+void RoadCanvas::resizeEvent(QResizeEvent* e) {
+	QGraphicsView::resizeEvent(e);
+
+	if (isVisible()) updateVisibleRoads();
+}
@@ -2,7 +2,11 @@
 
 #include "RoadGraph.h"
 #include "Sketch.h"
+#include "BBox.h"
 #include <qgraphicsview.h>
+#include <qgraphicsitem.h>
+#include <qhash.h>
+#include <qset.h>
 
 class MyMainWindow;
 
@@ -21,6 +25,8 @@ public:
 	RoadGraph* ref_roads;
 	Sketch* sketch;
 	float snapThreshold;
+	QHash<RoadEdge*, QList<QGraphicsItem*> > roadItems;	// the items of the fancy roads created so far
+	QSet<RoadEdge*> visibleRoads;							// the fancy roads whose items are shown
 
 public:
 	RoadCanvas(MyMainWindow* mainWin, float width, float height);
@@ -30,13 +36,15 @@ public:
 	void openRoad(const char* filename);
 	float showSimilarity(RoadGraph* roads);
 	void updateView();
-	void drawFancyRoads(RoadGraph* roads);
+	void updateVisibleRoads();
+	void drawFancyRoads(RoadGraph* roads, QSet<RoadEdge*>& visible);
 	void drawSimpleRoads(RoadGraph* roads);
-	void drawEdge(RoadGraph* roads, RoadEdgeDesc edge, float roadWidthBase, float highwayZ, float avenueZ, const QColor& color);
+	QGraphicsPathItem* drawEdge(RoadGraph* roads, RoadEdgeDesc edge, float roadWidthBase, float highwayZ, float avenueZ, const QColor& color);
 
 	void setZoom(float factor);
 	QVector2D modelToScene(const QVector2D& pt);
 	QVector2D sceneToModel(const QPointF& pt);
+	BBox getViewArea(float margin);
 
 signals:
 
@@ -44,5 +52,7 @@ public slots:
 	void mousePressEvent(QMouseEvent* e);
 	void mouseReleaseEvent(QMouseEvent* e);
 	void mouseMoveEvent(QMouseEvent* e);
+	void scrollContentsBy(int dx, int dy);
+	void resizeEvent(QResizeEvent* e);
 };
 
@@ -10,6 +10,9 @@ RoadEdge::RoadEdge(unsigned int lanes, unsigned int type, bool oneWay) {
 	this->group = 0;
 	this->seed = false;
 	this->fullyPaired = false;
+	this->handle = -1;
+	this->geometryCached = false;
+	this->length = 0.0f;
 }
 
 RoadEdge::~RoadEdge() {
@@ -19,20 +22,35 @@ int RoadEdge::getNumLanes() {
 	return lanes;
 }
 
+/**
+ * Return the length of the polyline.
+ * The length is cached, so invalidateGeometry() has to be called when the polyLine is modified directly.
+ */
 float RoadEdge::getLength() {
-	float length = 0.0f;
-	for (int i = 0; i < polyLine.size() - 1; i++) {
-		length += (polyLine[i + 1] - polyLine[i]).length();
-	}
+	if (!geometryCached) updateGeometry();
 
 	return length;
 }
 
+/**
+ * Return the axis aligned bounding box of the polyline.
+ * The bounding box is cached, so invalidateGeometry() has to be called when the polyLine is modified directly.
+ */
+const BBox& RoadEdge::getBBox() {
+	if (!geometryCached) updateGeometry();
+
+	return bbox;
+}
+
 int RoadEdge::getType() {
 	return type;
 }
 
-std::vector<QVector2D> RoadEdge::getPolyLine() {
+/**
+ * Return the polyline of the road segment.
+ * Note: The returned reference is not a copy, so it becomes invalid when this edge is modified or deleted.
+ */
+const std::vector<QVector2D>& RoadEdge::getPolyLine() const {
 	return polyLine;
 }
 
@@ -42,9 +60,37 @@ std::vector<QVector2D> RoadEdge::getPolyLine() {
  * @param pt		new point to be added
  */
 void RoadEdge::addPoint(const QVector2D &pt) {
+	// update the cache incrementally
+	if (geometryCached) {
+		if (polyLine.size() > 0) length += (pt - polyLine.back()).length();
+		bbox.addPoint(pt);
+	}
+
 	polyLine.push_back(pt);
 }
 
+/**
+ * Discard the cached length and bounding box.
+ * This has to be called after the points of the polyline are modified without addPoint.
+ */
+void RoadEdge::invalidateGeometry() {
+	geometryCached = false;
+}
+
+/**
+ * Compute the length and the bounding box of the polyline, and cache them.
+ */
+void RoadEdge::updateGeometry() {
+	length = 0.0f;
+	for (int i = 0; i < (int)polyLine.size() - 1; i++) {
+		length += (polyLine[i + 1] - polyLine[i]).length();
+	}
+
+	bbox.recalculate(polyLine);
+
+	geometryCached = true;
+}
+
 float RoadEdge::getWidth() {
 	return lanes * 2 * 3.5f;
 }
@@ -1,5 +1,6 @@
 ﻿#pragma once
 
+#include "BBox.h"
 #include <qvector2d.h>
 #include <vector>
 
@@ -16,6 +17,12 @@ public:
 	bool seed;			// if this edge is used as a seed of a forest
 	int group;			// to which tree in the forest this edge belongs to
 	bool fullyPaired;	// if this edge has a corresponding edge
+	int handle;			// slot of the generational handle in the graph (-1 if no handle is issued)
+
+	// cache of the length and the bounding box of the polyline
+	bool geometryCached;
+	float length;
+	BBox bbox;
 
 public:
 	RoadEdge(unsigned int lanes, unsigned int type, bool oneWay);
@@ -23,10 +30,15 @@ public:
 	
 	int getNumLanes();
 	float getLength();
+	const BBox& getBBox();
 	int getType();
-	std::vector<QVector2D> getPolyLine();
+	const std::vector<QVector2D>& getPolyLine() const;
 
 	void addPoint(const QVector2D &pt);
+	void invalidateGeometry();
 	float getWidth();
+
+private:
+	void updateGeometry();
 };
 
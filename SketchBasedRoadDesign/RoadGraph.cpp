@@ -1,7 +1,10 @@
 ﻿#include "RoadGraph.h"
 #include "GraphUtil.h"
+#include "VertexGrid.h"
+#include "SegmentGrid.h"
 #include <qset.h>
 #include <iostream>
+#include <new>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -11,21 +14,47 @@
 using namespace std;
 
 RoadGraph::RoadGraph() {
+	adjacencyIndex = NULL;
+	vertexGrid = NULL;
+	segmentGrid = NULL;
+	numValidVertices = 0;
+	numValidEdges = 0;
+	componentsUpToDate = false;
+	shared = false;
 }
 
 RoadGraph::~RoadGraph() {
 	clear();
+	disableAdjacencyIndex();
+	disableVertexIndex();
+	disableSegmentIndex();
 }
 
-void RoadGraph::generateMesh(float widthBase, float highwayHeight, float avenueHeight, float curbRatio, bool drawLocalStreets, float opacity) {
+/**
+ * Generate the mesh of the road edges.
+ *
+ * @param viewArea	if specified, only the valid edges overlapping with this area are drawn (see GraphUtil::getEdgesInRect)
+ */
+void RoadGraph::generateMesh(float widthBase, float highwayHeight, float avenueHeight, float curbRatio, bool drawLocalStreets, float opacity, const BBox* viewArea) {
 	renderables.clear();
 
 	renderables.push_back(Renderable(GL_TRIANGLES));
 
+	std::vector<RoadEdgeDesc> edges;
+	if (viewArea != NULL) {
+		edges = GraphUtil::getEdgesInRect(this, *viewArea);
+	} else {
+		RoadEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+			if (!graph[*ei]->valid) continue;
+
+			edges.push_back(*ei);
+		}
+	}
+
 	// road edge
-	RoadEdgeIter ei, eend;
-	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
-		RoadEdge* edge = graph[*ei];
+	for (int i = 0; i < edges.size(); i++) {
+		RoadEdge* edge = graph[edges[i]];
 
 		QColor color, bColor;
 		float height;
@@ -129,19 +158,34 @@ void RoadGraph::addMeshFromEdge(Renderable* renderable, RoadEdge* edge, float wi
  * Clear the road graph.
  */
 void RoadGraph::clear() {
-	RoadVertexIter vi, vend;
-	for (boost::tie(vi, vend) = boost::vertices(graph); vi != vend; ++vi) {
-		RoadVertex* v = graph[*vi];
-		delete v;
-	}
+	releaseAllHandles();
 
+	// The polylines of the edges have to be released one by one.
 	RoadEdgeIter ei, eend;
 	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
 		RoadEdge* edge = graph[*ei];
-		delete edge;
+		if (owns(edge)) edge->~RoadEdge();
 	}
 
+	// The vertices have nothing to release, so all the objects are freed at once with the slabs.
+	vertexPool.clear();
+	edgePool.clear();
+
 	graph.clear();
+
+	if (adjacencyIndex != NULL) adjacencyIndex->clear();
+	if (vertexGrid != NULL) vertexGrid->clear();
+	if (segmentGrid != NULL) segmentGrid->clear();
+	validDegrees.clear();
+	degreeBuckets.clear();
+	degreeBucketPositions.clear();
+	componentLabels.clear();
+	componentsUpToDate = false;
+	numValidVertices = 0;
+	numValidEdges = 0;
+	numValidEdgesByType.clear();
+	ownedVertices.clear();
+	ownedEdges.clear();
 }
 
 /**
@@ -164,10 +208,9 @@ void RoadGraph::load(FILE* fp, int roadType) {
 		fread(&x, sizeof(float), 1, fp);
 		fread(&y, sizeof(float), 1, fp);
 
-		RoadVertex* vertex = new RoadVertex(QVector2D(x, y));
+		RoadVertex* vertex = createVertex(QVector2D(x, y));
 
-		RoadVertexDesc desc = boost::add_vertex(graph);
-		graph[desc] = vertex;
+		RoadVertexDesc desc = addVertex(vertex);
 
 		idToDesc[id] = desc;
 	}
@@ -178,7 +221,7 @@ void RoadGraph::load(FILE* fp, int roadType) {
 
 	// Read each edge's information: the descs of two vertices, road type, the number of lanes, the number of points along the polyline, and the coordinate of each point along the polyline.
 	for (int i = 0; i < nEdges; i++) {
-		RoadEdge* edge = new RoadEdge(1, 1, false);
+		RoadEdge* edge = createEdge(1, 1, false);
 
 		RoadVertexDesc id1, id2;
 		fread(&id1, sizeof(RoadVertexDesc), 1, fp);
@@ -193,6 +236,7 @@ void RoadGraph::load(FILE* fp, int roadType) {
 
 		unsigned int nPoints;
 		fread(&nPoints, sizeof(unsigned int), 1, fp);
+		edge->polyLine.reserve(nPoints);
 
 		for (int j = 0; j < nPoints; j++) {
 			float x, y;
@@ -204,10 +248,9 @@ void RoadGraph::load(FILE* fp, int roadType) {
 
 		// 指定されたタイプの道路エッジのみを読み込む
 		if (((int)powf(2, (edge->type - 1)) & roadType)) {
-			std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, graph);
-			graph[edge_pair.first] = edge;
+			addEdge(src, tgt, edge);
 		} else {
-			delete edge;
+			destroy(edge);
 		}
 	}
 }
@@ -262,12 +305,13 @@ void RoadGraph::save(FILE* fp) {
 		}
 		fwrite(&oneWay, sizeof(unsigned int), 1, fp);
 
-		int nPoints = edge->getPolyLine().size();
+		const std::vector<QVector2D>& polyLine = edge->getPolyLine();
+		int nPoints = polyLine.size();
 		fwrite(&nPoints, sizeof(int), 1, fp);
 
-		for (int i = 0; i < edge->getPolyLine().size(); i++) {
-			float x = edge->getPolyLine()[i].x();
-			float y = edge->getPolyLine()[i].y();
+		for (int i = 0; i < polyLine.size(); i++) {
+			float x = polyLine[i].x();
+			float y = polyLine[i].y();
 			fwrite(&x, sizeof(float), 1, fp);
 			fwrite(&y, sizeof(float), 1, fp);
 		}
@@ -283,29 +327,24 @@ void RoadGraph::setWidth(float widthBase) {
 
 /**
  * エッジの重みを計算する。
- * DeadEndを繰り返し削除し、残ったやつの重みを1、削除されたやつの重みを0.1とする。
+ * DeadEndを繰り返し削除し、残ったやつ（2-core）の重みを1、削除されたやつの重みを0.1とする。
  */
 void RoadGraph::computeEdgeWeights() {
-	// DeadEndを削除して、重要なエッジのみを残す
-	RoadGraph* temp = GraphUtil::copyRoads(this);
-	GraphUtil::removeDeadEnd(temp);
+	// DeadEndを繰り返し削除した時に残る頂点を求める（グラフのコピーは不要）
+	std::vector<bool> core = GraphUtil::getTwoCore(this);
 
-	// 各エッジについて、重みを計算する
-	RoadVertexIter vi, vend;
-	for (boost::tie(vi, vend) = boost::vertices(graph); vi != vend; ++vi) {
-		if (!graph[*vi]->valid) continue;
-
-		RoadOutEdgeIter ei, eend;
-		for (boost::tie(ei, eend) = boost::out_edges(*vi, graph); ei != eend; ++ei) {
-			if (!graph[*ei]->valid) continue;
+	// 両端の頂点が残るエッジのみを重要とする
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		if (!graph[*ei]->valid) continue;
 
-			RoadVertexDesc tgt = boost::target(*ei, graph);
+		RoadVertexDesc src = boost::source(*ei, graph);
+		RoadVertexDesc tgt = boost::target(*ei, graph);
 
-			if (GraphUtil::hasEdge(temp, *vi, tgt)) {
-				graph[*ei]->weight = 1.0f;
-			} else {
-				graph[*ei]->weight = 0.1f;
-			}
+		if (core[src] && core[tgt]) {
+			detach(*ei)->weight = 1.0f;
+		} else {
+			detach(*ei)->weight = 0.1f;
 		}
 	}
 }
@@ -338,6 +377,687 @@ QList<RoadEdgeDesc> RoadGraph::getOrderedEdgesByImportance() {
 	return ret;
 }
 
+/**
+ * Create a vertex object from the pool of this graph.
+ * The vertex has to be added by addVertex, or released by destroy.
+ */
+RoadVertex* RoadGraph::createVertex(const QVector2D& pt) {
+	return new (vertexPool.allocate()) RoadVertex(pt);
+}
+
+/**
+ * Create a copy of the vertex object from the pool of this graph.
+ */
+RoadVertex* RoadGraph::createVertex(const RoadVertex& ref) {
+	return new (vertexPool.allocate()) RoadVertex(ref);
+}
+
+/**
+ * Create an edge object from the pool of this graph.
+ * The edge has to be added by addEdge, or released by destroy.
+ */
+RoadEdge* RoadGraph::createEdge(unsigned int lanes, unsigned int type, bool oneWay) {
+	return new (edgePool.allocate()) RoadEdge(lanes, type, oneWay);
+}
+
+/**
+ * Create a copy of the edge object from the pool of this graph.
+ */
+RoadEdge* RoadGraph::createEdge(const RoadEdge& ref) {
+	return new (edgePool.allocate()) RoadEdge(ref);
+}
+
+/**
+ * Return the vertex object to the pool.
+ */
+void RoadGraph::destroy(RoadVertex* v) {
+	if (shared) ownedVertices.remove(v);
+	vertexPool.release(v);
+}
+
+/**
+ * Return the edge object to the pool.
+ */
+void RoadGraph::destroy(RoadEdge* e) {
+	if (shared) ownedEdges.remove(e);
+	edgePool.release(e);
+}
+
+/**
+ * Add the vertex. The vertex object has to be created by createVertex of this graph, and is owned by this graph after this call.
+ * Use this function instead of boost::add_vertex so that the counts of the valid vertices are kept up to date.
+ */
+RoadVertexDesc RoadGraph::addVertex(RoadVertex* v) {
+	RoadVertexDesc desc = boost::add_vertex(graph);
+	graph[desc] = v;
+
+	if (shared) ownedVertices.insert(v);
+	if (v->valid) numValidVertices++;
+	if (vertexGrid != NULL) vertexGrid->insert(desc, v->pt);
+	growDegrees();
+	componentsUpToDate = false;
+
+	return desc;
+}
+
+/**
+ * Add the edge between src and tgt.
+ * The edge object has to be created by createEdge of this graph, and is owned by this graph after this call.
+ * Use this function instead of boost::add_edge so that the adjacency index is kept up to date.
+ */
+RoadEdgeDesc RoadGraph::addEdge(RoadVertexDesc src, RoadVertexDesc tgt, RoadEdge* edge) {
+	std::pair<RoadEdgeDesc, bool> edge_pair = boost::add_edge(src, tgt, graph);
+	graph[edge_pair.first] = edge;
+
+	if (shared) ownedEdges.insert(edge);
+	if (edge->valid) {
+		numValidEdges++;
+		numValidEdgesByType[edge->type]++;
+		updateDegree(edge_pair.first, 1);
+		updateComponents(edge_pair.first, true);
+
+		if (adjacencyIndex != NULL) {
+			adjacencyIndex->insert(adjacencyKey(src, tgt), edge_pair.first);
+		}
+		if (segmentGrid != NULL) segmentGrid->insert(this, edge_pair.first);
+	}
+
+	return edge_pair.first;
+}
+
+/**
+ * Validate or invalidate the vertex.
+ * Use this function instead of setting the valid flag directly so that the counts of the valid vertices are kept up to date.
+ */
+void RoadGraph::setValid(RoadVertexDesc v, bool valid) {
+	if (graph[v]->valid == valid) return;
+
+	detach(v)->valid = valid;
+	numValidVertices += valid ? 1 : -1;
+	componentsUpToDate = false;
+}
+
+/**
+ * Validate or invalidate the edge.
+ * Use this function instead of setting the valid flag directly so that the adjacency index is kept up to date.
+ */
+void RoadGraph::setValid(RoadEdgeDesc e, bool valid) {
+	if (graph[e]->valid == valid) return;
+
+	detach(e)->valid = valid;
+
+	numValidEdges += valid ? 1 : -1;
+	numValidEdgesByType[graph[e]->type] += valid ? 1 : -1;
+	updateDegree(e, valid ? 1 : -1);
+	updateComponents(e, valid);
+
+	if (adjacencyIndex != NULL) {
+		quint64 key = adjacencyKey(boost::source(e, graph), boost::target(e, graph));
+		if (valid) {
+			adjacencyIndex->insert(key, e);
+		} else {
+			adjacencyIndex->remove(key, e);
+		}
+	}
+
+	// the invalidated edges are skipped by the queries of the segment index
+	if (segmentGrid != NULL && valid) segmentGrid->insert(this, e);
+}
+
+/**
+ * Return the vertex object which can be modified.
+ * If this is a copy-on-write snapshot and the vertex is still shared with the original graph,
+ * the vertex is copied first so that the original graph is not affected.
+ */
+RoadVertex* RoadGraph::detach(RoadVertexDesc v) {
+	if (!owns(graph[v])) {
+		RoadVertex* new_v = createVertex(*graph[v]);
+		ownedVertices.insert(new_v);
+		graph[v] = new_v;
+	}
+
+	return graph[v];
+}
+
+/**
+ * Return the edge object which can be modified.
+ * If this is a copy-on-write snapshot and the edge is still shared with the original graph,
+ * the edge is copied first so that the original graph is not affected.
+ */
+RoadEdge* RoadGraph::detach(RoadEdgeDesc e) {
+	if (!owns(graph[e])) {
+		RoadEdge* new_e = createEdge(*graph[e]);
+		ownedEdges.insert(new_e);
+		graph[e] = new_e;
+	}
+
+	return graph[e];
+}
+
+/**
+ * Return true if the vertex object belongs to this graph, i.e. it is not shared with another graph.
+ */
+bool RoadGraph::owns(RoadVertex* v) const {
+	return !shared || ownedVertices.contains(v);
+}
+
+/**
+ * Return true if the edge object belongs to this graph, i.e. it is not shared with another graph.
+ */
+bool RoadGraph::owns(RoadEdge* e) const {
+	return !shared || ownedEdges.contains(e);
+}
+
+/**
+ * Move the vertex to the specified position. The polylines of the edges are not changed.
+ * Use this function instead of writing pt directly so that the spatial index of the vertices is kept up to date.
+ */
+void RoadGraph::setPt(RoadVertexDesc v, const QVector2D& pt) {
+	detach(v)->pt = pt;
+	if (vertexGrid != NULL) vertexGrid->move(v, pt);
+}
+
+/**
+ * Notify that the polyline of the edge is modified directly.
+ * The cached geometry of the edge is invalidated, and the segment index is updated.
+ */
+void RoadGraph::invalidateGeometry(RoadEdgeDesc e) {
+	detach(e)->invalidateGeometry();
+	if (segmentGrid != NULL && graph[e]->valid) segmentGrid->insert(this, e);
+}
+
+/**
+ * Return the number of valid edges of the vertex in constant time.
+ */
+int RoadGraph::getValidDegree(RoadVertexDesc v) const {
+	if (v >= validDegrees.size()) return 0;
+
+	return validDegrees[v];
+}
+
+/**
+ * Return the vertices which have the specified number of valid edges in constant time.
+ * The invalid vertices are included, and the order is arbitrary.
+ */
+const std::vector<RoadVertexDesc>& RoadGraph::getVerticesByDegree(int degree) {
+	static const std::vector<RoadVertexDesc> empty;
+
+	growDegrees();
+	if (degree < 0 || degree >= degreeBuckets.size()) return empty;
+
+	return degreeBuckets[degree];
+}
+
+/**
+ * Return the connected component of the vertex by the valid edges, or -1 if the vertex is invalid.
+ * The components are computed once, and kept until the graph is changed.
+ */
+int RoadGraph::getComponent(RoadVertexDesc v) {
+	if (!componentsUpToDate) rebuildComponents();
+
+	return componentLabels[v];
+}
+
+/**
+ * Return true if the two valid vertices are connected by the valid edges.
+ * Once the components are computed, this runs in constant time.
+ */
+bool RoadGraph::isConnected(RoadVertexDesc v1, RoadVertexDesc v2) {
+	int component = getComponent(v1);
+
+	return component >= 0 && component == getComponent(v2);
+}
+
+/**
+ * Rebuild all the indices from scratch.
+ * This has to be called when the descriptors are changed, e.g. by the compaction.
+ */
+void RoadGraph::rebuildIndices() {
+	rebuildCounts();
+	rebuildDegrees();
+	rebuildAdjacencyIndex();
+	rebuildVertexIndex();
+	rebuildSegmentIndex();
+	componentsUpToDate = false;
+}
+
+/**
+ * Build the adjacency index so that GraphUtil::hasEdge and GraphUtil::getEdge between two vertices run in constant time.
+ * Once it is built, it is updated by addEdge and setValid until disableAdjacencyIndex is called.
+ */
+void RoadGraph::enableAdjacencyIndex() {
+	if (adjacencyIndex != NULL) return;
+
+	adjacencyIndex = new QMultiHash<quint64, RoadEdgeDesc>();
+	rebuildAdjacencyIndex();
+}
+
+void RoadGraph::disableAdjacencyIndex() {
+	if (adjacencyIndex == NULL) return;
+
+	delete adjacencyIndex;
+	adjacencyIndex = NULL;
+}
+
+/**
+ * Rebuild the adjacency index from scratch.
+ * This has to be called when the edge descriptors are changed, e.g. by the compaction.
+ */
+void RoadGraph::rebuildAdjacencyIndex() {
+	if (adjacencyIndex == NULL) return;
+
+	adjacencyIndex->clear();
+	adjacencyIndex->reserve(boost::num_edges(graph));
+
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		if (!graph[*ei]->valid) continue;
+
+		adjacencyIndex->insert(adjacencyKey(boost::source(*ei, graph), boost::target(*ei, graph)), *ei);
+	}
+}
+
+/**
+ * Return the key of the adjacency index for the unordered pair of the vertices.
+ */
+quint64 RoadGraph::adjacencyKey(RoadVertexDesc v1, RoadVertexDesc v2) {
+	if (v1 > v2) std::swap(v1, v2);
+
+	return ((quint64)v1 << 32) | (quint64)(v2 & 0xffffffff);
+}
+
+/**
+ * Build the uniform grid of the vertex positions so that the proximity queries of GraphUtil::getVertex run
+ * without scanning all the vertices. Once it is built, it is updated by addVertex and setPt until disableVertexIndex is called.
+ * After the positions are changed in bulk without setPt (e.g. rotate, translate), rebuildVertexIndex has to be called.
+ *
+ * @param cellSize	the size of the cell. If it is not positive, the size is decided so that each cell has about one vertex.
+ */
+void RoadGraph::enableVertexIndex(float cellSize) {
+	if (vertexGrid != NULL) return;
+
+	if (cellSize <= 0.0f) {
+		cellSize = 100.0f;
+
+		BBox bbox;
+		int num = 0;
+		RoadVertexIter vi, vend;
+		for (boost::tie(vi, vend) = boost::vertices(graph); vi != vend; ++vi) {
+			if (!graph[*vi]->valid) continue;
+
+			bbox.addPoint(graph[*vi]->pt);
+			num++;
+		}
+
+		float area = bbox.dx() * bbox.dy();
+		if (num > 1 && area > 0.0f) cellSize = sqrtf(area / num);
+	}
+
+	vertexGrid = new VertexGrid(cellSize);
+	vertexGrid->build(this);
+}
+
+void RoadGraph::disableVertexIndex() {
+	if (vertexGrid == NULL) return;
+
+	delete vertexGrid;
+	vertexGrid = NULL;
+}
+
+/**
+ * Rebuild the spatial index of the vertices from scratch.
+ */
+void RoadGraph::rebuildVertexIndex() {
+	if (vertexGrid == NULL) return;
+
+	vertexGrid->build(this);
+}
+
+/**
+ * Build the uniform grid of the polyline segments of the valid edges so that GraphUtil::getEdge by the point and
+ * GraphUtil::findNearestEdge run without scanning all the edges.
+ * Once it is built, it is updated by addEdge, setValid, and invalidateGeometry until disableSegmentIndex is called.
+ * After the polylines are changed in bulk without invalidateGeometry (e.g. rotate, translate), rebuildSegmentIndex has to be called.
+ *
+ * @param cellSize	the size of the cell. If it is not positive, the size is decided so that each cell has about one edge.
+ */
+void RoadGraph::enableSegmentIndex(float cellSize) {
+	if (segmentGrid != NULL) return;
+
+	if (cellSize <= 0.0f) {
+		cellSize = 100.0f;
+
+		BBox bbox;
+		int num = 0;
+		RoadEdgeIter ei, eend;
+		for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+			if (!graph[*ei]->valid) continue;
+
+			bbox.combineWithBBox(graph[*ei]->getBBox());
+			num++;
+		}
+
+		float area = bbox.dx() * bbox.dy();
+		if (num > 1 && area > 0.0f) cellSize = sqrtf(area / num);
+	}
+
+	segmentGrid = new SegmentGrid(cellSize);
+	segmentGrid->build(this);
+}
+
+void RoadGraph::disableSegmentIndex() {
+	if (segmentGrid == NULL) return;
+
+	delete segmentGrid;
+	segmentGrid = NULL;
+}
+
+/**
+ * Rebuild the spatial index of the edges from scratch.
+ */
+void RoadGraph::rebuildSegmentIndex() {
+	if (segmentGrid == NULL) return;
+
+	segmentGrid->build(this);
+}
+
+/**
+ * Return the generational handle of the vertex. If no handle is issued yet, a new one is issued.
+ * A free slot is reused if there is any.
+ */
+RoadVertexHandle RoadGraph::getHandle(RoadVertexDesc desc) {
+	int index = findSlot(desc);
+	if (index >= 0) return RoadVertexHandle(index, vertexGenerations[index]);
+
+	if (freeVertexSlots.size() > 0) {
+		index = freeVertexSlots.back();
+		freeVertexSlots.pop_back();
+		vertexSlots[index] = desc;
+	} else {
+		index = vertexSlots.size();
+		vertexSlots.push_back(desc);
+		vertexGenerations.push_back(0);
+	}
+
+	detach(desc)->handle = index;
+
+	return RoadVertexHandle(index, vertexGenerations[index]);
+}
+
+/**
+ * Return the generational handle of the edge. If no handle is issued yet, a new one is issued.
+ * A free slot is reused if there is any.
+ */
+RoadEdgeHandle RoadGraph::getHandle(RoadEdgeDesc desc) {
+	int index = findSlot(desc);
+	if (index >= 0) return RoadEdgeHandle(index, edgeGenerations[index]);
+
+	if (freeEdgeSlots.size() > 0) {
+		index = freeEdgeSlots.back();
+		freeEdgeSlots.pop_back();
+		edgeSlots[index] = desc;
+	} else {
+		index = edgeSlots.size();
+		edgeSlots.push_back(desc);
+		edgeGenerations.push_back(0);
+	}
+
+	detach(desc)->handle = index;
+
+	return RoadEdgeHandle(index, edgeGenerations[index]);
+}
+
+/**
+ * Resolve the handle to the current vertex descriptor.
+ *
+ * @return		false if the vertex has been removed or invalidated.
+ */
+bool RoadGraph::resolve(const RoadVertexHandle& handle, RoadVertexDesc& desc) {
+	if (handle.index < 0 || handle.index >= vertexSlots.size()) return false;
+	if (vertexGenerations[handle.index] != handle.generation) return false;
+
+	desc = vertexSlots[handle.index];
+	return graph[desc]->valid;
+}
+
+/**
+ * Resolve the handle to the current edge descriptor.
+ *
+ * @return		false if the edge has been removed or invalidated.
+ */
+bool RoadGraph::resolve(const RoadEdgeHandle& handle, RoadEdgeDesc& desc) {
+	if (handle.index < 0 || handle.index >= edgeSlots.size()) return false;
+	if (edgeGenerations[handle.index] != handle.generation) return false;
+
+	desc = edgeSlots[handle.index];
+	return graph[desc]->valid;
+}
+
+/**
+ * Update the slot of the vertex when its descriptor is changed by the compaction.
+ * Note: This has to be called before the adjacency is rebuilt.
+ */
+void RoadGraph::updateHandle(RoadVertexDesc desc, RoadVertexDesc new_desc) {
+	int index = findSlot(desc);
+	if (index >= 0) vertexSlots[index] = new_desc;
+}
+
+/**
+ * Bind the slot to the new descriptor of the edge after the adjacency is rebuilt by the compaction.
+ * Unlike the vertex descriptor, the edge descriptor refers to the storage of the adjacency,
+ * so the slot has to be looked up by findSlot before the adjacency is rebuilt.
+ */
+void RoadGraph::updateHandle(int index, RoadEdgeDesc new_desc) {
+	if (index >= 0) edgeSlots[index] = new_desc;
+}
+
+/**
+ * Release the slot of the vertex before it is deleted. The handles of the vertex become stale.
+ */
+void RoadGraph::releaseHandle(RoadVertexDesc desc) {
+	int index = findSlot(desc);
+	if (index < 0) return;
+
+	vertexSlots[index] = boost::graph_traits<BGLGraph>::null_vertex();
+	vertexGenerations[index]++;
+	freeVertexSlots.push_back(index);
+	graph[desc]->handle = -1;
+}
+
+/**
+ * Release the slot of the edge before it is deleted. The handles of the edge become stale.
+ */
+void RoadGraph::releaseHandle(RoadEdgeDesc desc) {
+	int index = findSlot(desc);
+	if (index < 0) return;
+
+	edgeSlots[index] = RoadEdgeDesc();
+	edgeGenerations[index]++;
+	freeEdgeSlots.push_back(index);
+	graph[desc]->handle = -1;
+}
+
+/**
+ * Release all the slots. All the handles issued so far become stale.
+ */
+void RoadGraph::releaseAllHandles() {
+	for (int i = 0; i < vertexSlots.size(); i++) {
+		if (vertexSlots[i] == boost::graph_traits<BGLGraph>::null_vertex()) continue;
+
+		vertexSlots[i] = boost::graph_traits<BGLGraph>::null_vertex();
+		vertexGenerations[i]++;
+		freeVertexSlots.push_back(i);
+	}
+
+	for (int i = 0; i < edgeSlots.size(); i++) {
+		if (edgeSlots[i] == RoadEdgeDesc()) continue;
+
+		edgeSlots[i] = RoadEdgeDesc();
+		edgeGenerations[i]++;
+		freeEdgeSlots.push_back(i);
+	}
+}
+
+/**
+ * Return the slot of the vertex, or -1 if no handle is issued.
+ * The vertex copied from another vertex or another graph keeps the slot index of the original one,
+ * so the slot is checked whether it really refers to this vertex.
+ */
+int RoadGraph::findSlot(RoadVertexDesc desc) {
+	int index = graph[desc]->handle;
+	if (index < 0 || index >= vertexSlots.size()) return -1;
+	if (vertexSlots[index] != desc) return -1;
+
+	return index;
+}
+
+/**
+ * Return the slot of the edge, or -1 if no handle is issued.
+ */
+int RoadGraph::findSlot(RoadEdgeDesc desc) {
+	int index = graph[desc]->handle;
+	if (index < 0 || index >= edgeSlots.size()) return -1;
+	if (edgeSlots[index] != desc) return -1;
+
+	return index;
+}
+
+/**
+ * Add delta to the valid degrees of the both end vertices of the edge.
+ */
+void RoadGraph::updateDegree(RoadEdgeDesc e, int delta) {
+	RoadVertexDesc src = boost::source(e, graph);
+	RoadVertexDesc tgt = boost::target(e, graph);
+
+	if (std::max(src, tgt) >= validDegrees.size()) growDegrees();
+
+	moveToDegreeBucket(src, validDegrees[src] + delta);
+	moveToDegreeBucket(tgt, validDegrees[tgt] + delta);
+}
+
+/**
+ * Change the valid degree of the vertex, and move the vertex to the bucket of the new degree.
+ * The vertex is swapped with the last one of its bucket, and removed in constant time.
+ */
+void RoadGraph::moveToDegreeBucket(RoadVertexDesc v, int degree) {
+	std::vector<RoadVertexDesc>& bucket = degreeBuckets[validDegrees[v]];
+	RoadVertexDesc last = bucket.back();
+	bucket[degreeBucketPositions[v]] = last;
+	degreeBucketPositions[last] = degreeBucketPositions[v];
+	bucket.pop_back();
+
+	validDegrees[v] = degree;
+	if (degree >= degreeBuckets.size()) degreeBuckets.resize(degree + 1);
+	degreeBucketPositions[v] = degreeBuckets[degree].size();
+	degreeBuckets[degree].push_back(v);
+}
+
+/**
+ * Register the vertices which are not counted yet as the vertices of degree 0.
+ */
+void RoadGraph::growDegrees() {
+	int nVertices = boost::num_vertices(graph);
+	if (validDegrees.size() >= nVertices) return;
+
+	if (degreeBuckets.empty()) degreeBuckets.resize(1);
+	for (int v = validDegrees.size(); v < nVertices; v++) {
+		degreeBucketPositions.push_back(degreeBuckets[0].size());
+		degreeBuckets[0].push_back(v);
+	}
+	validDegrees.resize(nVertices, 0);
+}
+
+/**
+ * Discard the connected components if they are changed by validating or invalidating the edge.
+ * Validating an edge within a component does not change the components.
+ */
+void RoadGraph::updateComponents(RoadEdgeDesc e, bool valid) {
+	if (!componentsUpToDate) return;
+
+	if (valid && componentLabels[boost::source(e, graph)] == componentLabels[boost::target(e, graph)]) return;
+
+	componentsUpToDate = false;
+}
+
+/**
+ * Label the connected components by BFS from scratch.
+ */
+void RoadGraph::rebuildComponents() {
+	componentLabels.assign(boost::num_vertices(graph), -1);
+
+	int numComponents = 0;
+	std::vector<RoadVertexDesc> queue;
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(graph); vi != vend; ++vi) {
+		if (!graph[*vi]->valid || componentLabels[*vi] >= 0) continue;
+
+		componentLabels[*vi] = numComponents;
+		queue.clear();
+		queue.push_back(*vi);
+		for (int i = 0; i < queue.size(); i++) {
+			RoadOutEdgeIter ei, eend;
+			for (boost::tie(ei, eend) = boost::out_edges(queue[i], graph); ei != eend; ++ei) {
+				if (!graph[*ei]->valid) continue;
+
+				RoadVertexDesc tgt = boost::target(*ei, graph);
+				if (!graph[tgt]->valid || componentLabels[tgt] >= 0) continue;
+
+				componentLabels[tgt] = numComponents;
+				queue.push_back(tgt);
+			}
+		}
+
+		numComponents++;
+	}
+
+	componentsUpToDate = true;
+}
+
+/**
+ * Count the valid vertices and edges from scratch.
+ */
+void RoadGraph::rebuildCounts() {
+	numValidVertices = 0;
+	numValidEdges = 0;
+	numValidEdgesByType.clear();
+
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(graph); vi != vend; ++vi) {
+		if (graph[*vi]->valid) numValidVertices++;
+	}
+
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		if (!graph[*ei]->valid) continue;
+
+		numValidEdges++;
+		numValidEdgesByType[graph[*ei]->type]++;
+	}
+}
+
+/**
+ * Count the valid degrees of all the vertices from scratch.
+ */
+void RoadGraph::rebuildDegrees() {
+	validDegrees.assign(boost::num_vertices(graph), 0);
+
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(graph); ei != eend; ++ei) {
+		if (!graph[*ei]->valid) continue;
+
+		validDegrees[boost::source(*ei, graph)]++;
+		validDegrees[boost::target(*ei, graph)]++;
+	}
+
+	degreeBuckets.clear();
+	degreeBucketPositions.resize(validDegrees.size());
+	for (int v = 0; v < validDegrees.size(); v++) {
+		if (validDegrees[v] >= degreeBuckets.size()) degreeBuckets.resize(validDegrees[v] + 1);
+		degreeBucketPositions[v] = degreeBuckets[validDegrees[v]].size();
+		degreeBuckets[validDegrees[v]].push_back(v);
+	}
+}
+
 LessWeight::LessWeight(RoadGraph* roads) {
 	this->roads = roads;
 }
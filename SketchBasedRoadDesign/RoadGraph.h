@@ -3,8 +3,12 @@
 #include "RoadVertex.h"
 #include "RoadEdge.h"
 #include "Renderable.h"
+#include "ObjectPool.h"
 #include <stdio.h>
 #include <qvector2d.h>
+#include <qhash.h>
+#include <qmap.h>
+#include <qset.h>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/properties.hpp>
 #include <boost/graph/graph_traits.hpp>
@@ -23,6 +27,10 @@ typedef graph_traits<BGLGraph>::edge_iterator RoadEdgeIter;
 typedef graph_traits<BGLGraph>::out_edge_iterator RoadOutEdgeIter;
 typedef graph_traits<BGLGraph>::in_edge_iterator RoadInEdgeIter;
 
+class VertexGrid;
+class SegmentGrid;
+class BBox;
+
 class CollapseAction {
 public:
 	RoadVertexDesc childNode;
@@ -31,6 +39,44 @@ public:
 	std::vector<RoadEdgeDesc> addedEdges;
 };
 
+/**
+ * Generational handle of a vertex.
+ * Unlike RoadVertexDesc, the handle stays valid across the compaction of the graph (GraphUtil::clean).
+ * When the vertex is removed, the generation of its slot is incremented, so the stale handles can be detected,
+ * and the slot is reused by another vertex.
+ */
+class RoadVertexHandle {
+public:
+	int index;
+	unsigned int generation;
+
+public:
+	RoadVertexHandle() : index(-1), generation(0) {}
+	RoadVertexHandle(int index, unsigned int generation) : index(index), generation(generation) {}
+
+	bool isNull() const { return index < 0; }
+	bool operator==(const RoadVertexHandle& other) const { return index == other.index && generation == other.generation; }
+	bool operator!=(const RoadVertexHandle& other) const { return !(*this == other); }
+};
+
+/**
+ * Generational handle of an edge.
+ * Unlike RoadEdgeDesc, the handle stays valid across the compaction of the graph (GraphUtil::clean).
+ */
+class RoadEdgeHandle {
+public:
+	int index;
+	unsigned int generation;
+
+public:
+	RoadEdgeHandle() : index(-1), generation(0) {}
+	RoadEdgeHandle(int index, unsigned int generation) : index(index), generation(generation) {}
+
+	bool isNull() const { return index < 0; }
+	bool operator==(const RoadEdgeHandle& other) const { return index == other.index && generation == other.generation; }
+	bool operator!=(const RoadEdgeHandle& other) const { return !(*this == other); }
+};
+
 class RoadGraph {
 public:
 	BGLGraph graph;
@@ -38,11 +84,53 @@ public:
 	std::vector<Renderable> renderables;
 	float widthBase;
 
+	// slots of the generational handles
+	std::vector<RoadVertexDesc> vertexSlots;
+	std::vector<unsigned int> vertexGenerations;
+	std::vector<int> freeVertexSlots;
+	std::vector<RoadEdgeDesc> edgeSlots;
+	std::vector<unsigned int> edgeGenerations;
+	std::vector<int> freeEdgeSlots;
+
+	// adjacency index (optional): the unordered pair of vertices -> the valid edges between them
+	QMultiHash<quint64, RoadEdgeDesc>* adjacencyIndex;
+
+	// spatial index of the vertex positions (optional)
+	VertexGrid* vertexGrid;
+
+	// spatial index of the polyline segments of the valid edges (optional)
+	SegmentGrid* segmentGrid;
+
+	// the number of valid edges of each vertex (the vertices beyond the size have no valid edge)
+	std::vector<int> validDegrees;
+
+	// the vertices of each valid degree, and the position of each vertex in its bucket
+	std::vector<std::vector<RoadVertexDesc> > degreeBuckets;
+	std::vector<int> degreeBucketPositions;
+
+	// connected component of each vertex by the valid edges (-1 for the invalid vertices), which is computed on demand
+	std::vector<int> componentLabels;
+	bool componentsUpToDate;
+
+	// live counts of the valid vertices and edges
+	int numValidVertices;
+	int numValidEdges;
+	QMap<unsigned int, int> numValidEdgesByType;
+
+	// copy-on-write snapshot: the vertices and edges are shared with the original graph until they are detached
+	bool shared;
+	QSet<RoadVertex*> ownedVertices;
+	QSet<RoadEdge*> ownedEdges;
+
+	// memory pools of the vertex and edge objects
+	ObjectPool<RoadVertex> vertexPool;
+	ObjectPool<RoadEdge> edgePool;
+
 public:
 	RoadGraph();
 	~RoadGraph();
 
-	void generateMesh(float widthBase, float highwayHeight, float avenueHeight, float curbRatio, bool drawLocalStreets, float opacity = 1.0f);
+	void generateMesh(float widthBase, float highwayHeight, float avenueHeight, float curbRatio, bool drawLocalStreets, float opacity = 1.0f, const BBox* viewArea = NULL);
 	void RoadGraph::addMeshFromEdge(Renderable* renderable, RoadEdge* edge, float widthBase, QColor color, float height);
 
 	void clear();
@@ -53,6 +141,67 @@ public:
 
 	QList<RoadEdgeDesc> getOrderedEdgesByImportance();
 
+	RoadVertex* createVertex(const QVector2D& pt);
+	RoadVertex* createVertex(const RoadVertex& ref);
+	RoadEdge* createEdge(unsigned int lanes, unsigned int type, bool oneWay);
+	RoadEdge* createEdge(const RoadEdge& ref);
+	void destroy(RoadVertex* v);
+	void destroy(RoadEdge* e);
+	RoadVertexDesc addVertex(RoadVertex* v);
+	RoadEdgeDesc addEdge(RoadVertexDesc src, RoadVertexDesc tgt, RoadEdge* edge);
+	void setValid(RoadVertexDesc v, bool valid);
+	void setValid(RoadEdgeDesc e, bool valid);
+	RoadVertex* detach(RoadVertexDesc v);
+	RoadEdge* detach(RoadEdgeDesc e);
+	bool owns(RoadVertex* v) const;
+	bool owns(RoadEdge* e) const;
+	void setPt(RoadVertexDesc v, const QVector2D& pt);
+	void invalidateGeometry(RoadEdgeDesc e);
+	int getValidDegree(RoadVertexDesc v) const;
+	const std::vector<RoadVertexDesc>& getVerticesByDegree(int degree);
+	int getComponent(RoadVertexDesc v);
+	bool isConnected(RoadVertexDesc v1, RoadVertexDesc v2);
+	void rebuildIndices();
+
+	void enableAdjacencyIndex();
+	void disableAdjacencyIndex();
+	void rebuildAdjacencyIndex();
+	static quint64 adjacencyKey(RoadVertexDesc v1, RoadVertexDesc v2);
+
+	void enableVertexIndex(float cellSize = 0.0f);
+	void disableVertexIndex();
+	void rebuildVertexIndex();
+
+	void enableSegmentIndex(float cellSize = 0.0f);
+	void disableSegmentIndex();
+	void rebuildSegmentIndex();
+
+	RoadVertexHandle getHandle(RoadVertexDesc desc);
+	RoadEdgeHandle getHandle(RoadEdgeDesc desc);
+	bool resolve(const RoadVertexHandle& handle, RoadVertexDesc& desc);
+	bool resolve(const RoadEdgeHandle& handle, RoadEdgeDesc& desc);
+	void updateHandle(RoadVertexDesc desc, RoadVertexDesc new_desc);
+	void updateHandle(int index, RoadEdgeDesc new_desc);
+	void releaseHandle(RoadVertexDesc desc);
+	void releaseHandle(RoadEdgeDesc desc);
+	int findSlot(RoadVertexDesc desc);
+	int findSlot(RoadEdgeDesc desc);
+
+private:
+	// The graph owns its vertices and edges through the pools, so it cannot be copied member by member.
+	// Use GraphUtil::copyRoads or GraphUtil::createSnapshot instead. (declared but not defined)
+	RoadGraph(const RoadGraph& ref);
+	RoadGraph& operator=(const RoadGraph& ref);
+
+	void releaseAllHandles();
+	void updateDegree(RoadEdgeDesc e, int delta);
+	void moveToDegreeBucket(RoadVertexDesc v, int degree);
+	void growDegrees();
+	void rebuildDegrees();
+	void updateComponents(RoadEdgeDesc e, bool valid);
+	void rebuildComponents();
+	void rebuildCounts();
+
 };
 
 class LessWeight {
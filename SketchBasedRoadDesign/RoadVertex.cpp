@@ -7,6 +7,7 @@ RoadVertex::RoadVertex() {
 	this->pair = false;
 	this->finalized = false;
 	this->valid = true;
+	this->handle = -1;
 }
 
 RoadVertex::RoadVertex(const QVector2D &pt) {
@@ -16,6 +17,7 @@ RoadVertex::RoadVertex(const QVector2D &pt) {
 	this->pair = false;
 	this->finalized = false;
 	this->valid = true;
+	this->handle = -1;
 }
 
 const QVector2D& RoadVertex::getPt() const {
@@ -12,6 +12,7 @@ public:
 	bool pair;
 	bool finalized;
 	bool valid;
+	int handle;			// slot of the generational handle in the graph (-1 if no handle is issued)
 
 public:
 	RoadVertex();
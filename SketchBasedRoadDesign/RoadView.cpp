@@ -44,8 +44,9 @@ void RoadView::load(const char* filename) {
  * Compute the similarity between this road and the sketch (roads2).
  */
 float RoadView::showSimilarity(RoadGraph* roads2, float sketchCanvasSize, bool zoomedIn) {
-	RoadGraph* r1 = GraphUtil::copyRoads(roads);
-	RoadGraph* r2 = GraphUtil::copyRoads(roads2);
+	// The matching only marks the paired edges, so the snapshots are enough.
+	RoadGraph* r1 = GraphUtil::createSnapshot(roads);
+	RoadGraph* r2 = GraphUtil::createSnapshot(roads2);
 
 	// Compute the importance of each edge
 	//GraphUtil::computeImportanceOfEdges(r1, 1.0f, 1.0f, 1.0f);
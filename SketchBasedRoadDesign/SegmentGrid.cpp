@@ -0,0 +1,312 @@
+#include "SegmentGrid.h"
+#include "Util.h"
+#include <qset.h>
+#include <limits>
+#include <algorithm>
+#include <math.h>
+
+SegmentGrid::SegmentGrid(float cellSize) : cellSize(cellSize) {
+	clear();
+}
+
+SegmentGrid::~SegmentGrid() {
+}
+
+float SegmentGrid::getCellSize() const {
+	return cellSize;
+}
+
+/**
+ * Register all the valid edges of the road graph from scratch.
+ */
+void SegmentGrid::build(RoadGraph* roads) {
+	clear();
+
+	RoadEdgeIter ei, eend;
+	for (boost::tie(ei, eend) = boost::edges(roads->graph); ei != eend; ++ei) {
+		edgeOrders[ei->get_property()] = numEdgeOrders++;
+
+		if (!roads->graph[*ei]->valid) continue;
+
+		addEdge(roads, *ei);
+	}
+
+	numBuiltEntries = numEntries;
+}
+
+void SegmentGrid::clear() {
+	cells.clear();
+	numEntries = 0;
+	numBuiltEntries = 0;
+	edgeOrders.clear();
+	numEdgeOrders = 0;
+
+	minCellX = std::numeric_limits<int>::max();
+	minCellY = std::numeric_limits<int>::max();
+	maxCellX = std::numeric_limits<int>::min();
+	maxCellY = std::numeric_limits<int>::min();
+}
+
+/**
+ * Register the edge to all the cells its polyline passes through.
+ * This has to be called again when the polyline is changed. The old entries are left as they are,
+ * and if they become too many, the grid is rebuilt from scratch.
+ */
+void SegmentGrid::insert(RoadGraph* roads, RoadEdgeDesc e) {
+	if (numEntries > numBuiltEntries * 2 + 1024) {
+		build(roads);
+	} else {
+		addEdge(roads, e);
+	}
+}
+
+/**
+ * Add the entries of the edge to the cells its polyline passes through.
+ */
+void SegmentGrid::addEdge(RoadGraph* roads, RoadEdgeDesc e) {
+	// the new edges are added at the end of the edge list
+	if (!edgeOrders.contains(e.get_property())) edgeOrders[e.get_property()] = numEdgeOrders++;
+
+	const std::vector<QVector2D>& polyLine = roads->graph[e]->getPolyLine();
+	if (polyLine.size() == 0) return;
+
+	std::vector<quint64> keys;
+	if (polyLine.size() == 1) {
+		addCells(polyLine[0], polyLine[0], keys);
+	}
+	for (int i = 0; i < (int)polyLine.size() - 1; i++) {
+		addCells(polyLine[i], polyLine[i + 1], keys);
+	}
+
+	// the consecutive segments share the cells
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	for (int i = 0; i < keys.size(); i++) {
+		cells[keys[i]].push_back(e);
+	}
+	numEntries += keys.size();
+}
+
+/**
+ * Find the closest edge within the threshold from the specified point.
+ * The cells are visited ring by ring around the point, and the search stops when no closer edge can be found in the remaining rings.
+ * Among the equidistant edges, the first one in boost::edges() is chosen.
+ *
+ * @param ignore		the edges incident to this vertex are ignored (null_vertex() to ignore nothing)
+ * @param dist			the distance to the closest edge
+ * @param closestPt		the closest point on the closest edge
+ * @return				true if the edge is found. Otherwise, false and e, dist, and closestPt are not changed.
+ */
+bool SegmentGrid::findNearest(RoadGraph* roads, const QVector2D& pt, float threshold, RoadVertexDesc ignore, RoadEdgeDesc& e, float& dist, QVector2D& closestPt, bool onlyValidEdge) const {
+	int cx = toCell(pt.x());
+	int cy = toCell(pt.y());
+
+	bool found = false;
+	RoadEdgeDesc nearest_e;
+	QVector2D nearest_pt;
+	float min_dist = threshold;
+
+	QSet<RoadEdge*> visited;
+
+	int max_r = maxRing(cx, cy);
+	for (int r = minRing(cx, cy); r <= max_r; r++) {
+		// the segments which are not registered in the inner rings are at least (r - 1) * cellSize away from the point
+		if ((r - 1) * cellSize > min_dist) break;
+
+		for (int dy = -r; dy <= r; dy++) {
+			int step = (dy == -r || dy == r) ? 1 : 2 * r;
+			for (int dx = -r; dx <= r; dx += step) {
+				QHash<quint64, std::vector<RoadEdgeDesc> >::const_iterator it = cells.constFind(cellKey(cx + dx, cy + dy));
+				if (it == cells.constEnd()) continue;
+
+				const std::vector<RoadEdgeDesc>& cell = it.value();
+				for (int i = 0; i < cell.size(); i++) {
+					if (!isCandidate(roads, cell[i], ignore, onlyValidEdge)) continue;
+					if (visited.contains(roads->graph[cell[i]])) continue;
+					visited.insert(roads->graph[cell[i]]);
+
+					QVector2D pt2;
+					float d = Util::pointPolylineDistanceXY(roads->graph[cell[i]]->getPolyLine(), pt, pt2);
+					if (d > min_dist) continue;
+					if (found && d == min_dist && edgeOrder(cell[i]) > edgeOrder(nearest_e)) continue;
+
+					nearest_e = cell[i];
+					nearest_pt = pt2;
+					min_dist = d;
+					found = true;
+				}
+			}
+		}
+	}
+
+	if (found) {
+		e = nearest_e;
+		dist = min_dist;
+		closestPt = nearest_pt;
+	}
+
+	return found;
+}
+
+/**
+ * Return the order of the edge in boost::edges(), so that the closest edge is chosen among the equidistant ones
+ * in the same way as the linear scan.
+ */
+int SegmentGrid::edgeOrder(RoadEdgeDesc e) const {
+	return edgeOrders.value(e.get_property(), std::numeric_limits<int>::max());
+}
+
+/**
+ * Return all the edges within the radius from the specified point in no particular order.
+ *
+ * @param ignore		the edges incident to this vertex are ignored (null_vertex() to ignore nothing)
+ */
+std::vector<RoadEdgeDesc> SegmentGrid::findInRadius(RoadGraph* roads, const QVector2D& pt, float radius, RoadVertexDesc ignore, bool onlyValidEdge) const {
+	std::vector<RoadEdgeDesc> ret;
+
+	QSet<RoadEdge*> visited;
+
+	int cx0 = std::max(toCell(pt.x() - radius), minCellX);
+	int cx1 = std::min(toCell(pt.x() + radius), maxCellX);
+	int cy0 = std::max(toCell(pt.y() - radius), minCellY);
+	int cy1 = std::min(toCell(pt.y() + radius), maxCellY);
+
+	for (int cy = cy0; cy <= cy1; cy++) {
+		for (int cx = cx0; cx <= cx1; cx++) {
+			QHash<quint64, std::vector<RoadEdgeDesc> >::const_iterator it = cells.constFind(cellKey(cx, cy));
+			if (it == cells.constEnd()) continue;
+
+			const std::vector<RoadEdgeDesc>& cell = it.value();
+			for (int i = 0; i < cell.size(); i++) {
+				if (!isCandidate(roads, cell[i], ignore, onlyValidEdge)) continue;
+				if (visited.contains(roads->graph[cell[i]])) continue;
+				visited.insert(roads->graph[cell[i]]);
+
+				QVector2D pt2;
+				if (Util::pointPolylineDistanceXY(roads->graph[cell[i]]->getPolyLine(), pt, pt2) <= radius) ret.push_back(cell[i]);
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Return the edges registered in the cells overlapping with the rectangle whose bounding boxes also overlap with it.
+ * All the edges passing through the rectangle are included. The edges are returned in the order of the cells.
+ */
+std::vector<RoadEdgeDesc> SegmentGrid::findInRect(RoadGraph* roads, const BBox& rect, bool onlyValidEdge) const {
+	std::vector<RoadEdgeDesc> ret;
+	if (rect.minPt.x() > rect.maxPt.x() || rect.minPt.y() > rect.maxPt.y()) return ret;
+
+	QSet<RoadEdge*> visited;
+
+	// clamp the rectangle to the registered cells before converting it to the cells to avoid the overflow
+	int cx0 = rect.minPt.x() <= minCellX * cellSize ? minCellX : toCell(rect.minPt.x());
+	int cx1 = rect.maxPt.x() >= (maxCellX + 1) * cellSize ? maxCellX : toCell(rect.maxPt.x());
+	int cy0 = rect.minPt.y() <= minCellY * cellSize ? minCellY : toCell(rect.minPt.y());
+	int cy1 = rect.maxPt.y() >= (maxCellY + 1) * cellSize ? maxCellY : toCell(rect.maxPt.y());
+
+	for (int cy = cy0; cy <= cy1; cy++) {
+		for (int cx = cx0; cx <= cx1; cx++) {
+			QHash<quint64, std::vector<RoadEdgeDesc> >::const_iterator it = cells.constFind(cellKey(cx, cy));
+			if (it == cells.constEnd()) continue;
+
+			const std::vector<RoadEdgeDesc>& cell = it.value();
+			for (int i = 0; i < cell.size(); i++) {
+				if (!isCandidate(roads, cell[i], boost::graph_traits<BGLGraph>::null_vertex(), onlyValidEdge)) continue;
+				if (visited.contains(roads->graph[cell[i]])) continue;
+				visited.insert(roads->graph[cell[i]]);
+
+				BBox bbox = roads->graph[cell[i]]->getBBox();
+				if (bbox.overlapsWithBBoxXY(rect)) ret.push_back(cell[i]);
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * Add the keys of the cells which the segment passes through.
+ * The cells are scanned row by row, and in each row, the range of the segment clipped by the row is covered.
+ */
+void SegmentGrid::addCells(const QVector2D& p0, const QVector2D& p1, std::vector<quint64>& keys) {
+	// a small margin to tolerate the rounding errors on the borders of the cells
+	float margin = cellSize * 0.001f;
+
+	float minY = std::min(p0.y(), p1.y());
+	float maxY = std::max(p0.y(), p1.y());
+
+	int cy0 = toCell(minY - margin);
+	int cy1 = toCell(maxY + margin);
+	for (int cy = cy0; cy <= cy1; cy++) {
+		float x0 = p0.x();
+		float x1 = p1.x();
+		if (p0.y() != p1.y()) {
+			float y0 = std::max(cy * cellSize, minY);
+			float y1 = std::min((cy + 1) * cellSize, maxY);
+			x0 = p0.x() + (p1.x() - p0.x()) * (y0 - p0.y()) / (p1.y() - p0.y());
+			x1 = p0.x() + (p1.x() - p0.x()) * (y1 - p0.y()) / (p1.y() - p0.y());
+		}
+
+		int cx0 = toCell(std::min(x0, x1) - margin);
+		int cx1 = toCell(std::max(x0, x1) + margin);
+		for (int cx = cx0; cx <= cx1; cx++) {
+			keys.push_back(cellKey(cx, cy));
+		}
+
+		if (cx0 < minCellX) minCellX = cx0;
+		if (cx1 > maxCellX) maxCellX = cx1;
+	}
+
+	if (cy0 < minCellY) minCellY = cy0;
+	if (cy1 > maxCellY) maxCellY = cy1;
+}
+
+/**
+ * Return true if the edge has to be checked by the query.
+ */
+bool SegmentGrid::isCandidate(RoadGraph* roads, RoadEdgeDesc e, RoadVertexDesc ignore, bool onlyValidEdge) const {
+	RoadVertexDesc src = boost::source(e, roads->graph);
+	RoadVertexDesc tgt = boost::target(e, roads->graph);
+	if (src == ignore || tgt == ignore) return false;
+
+	if (onlyValidEdge) {
+		if (!roads->graph[e]->valid) return false;
+		if (!roads->graph[src]->valid) return false;
+		if (!roads->graph[tgt]->valid) return false;
+	}
+
+	return true;
+}
+
+int SegmentGrid::toCell(float x) const {
+	return (int)floor(x / cellSize);
+}
+
+quint64 SegmentGrid::cellKey(int cx, int cy) {
+	return ((quint64)(unsigned int)cx << 32) | (quint64)(unsigned int)cy;
+}
+
+/**
+ * Return the first ring around the cell that overlaps with the registered cells.
+ */
+int SegmentGrid::minRing(int cx, int cy) const {
+	if (minCellX > maxCellX) return 0;
+
+	int dx = std::max(std::max(minCellX - cx, cx - maxCellX), 0);
+	int dy = std::max(std::max(minCellY - cy, cy - maxCellY), 0);
+
+	return std::max(dx, dy);
+}
+
+/**
+ * Return the number of rings around the cell that cover all the registered cells (-1 if the grid is empty).
+ */
+int SegmentGrid::maxRing(int cx, int cy) const {
+	if (minCellX > maxCellX) return -1;
+
+	return std::max(std::max(cx - minCellX, maxCellX - cx), std::max(cy - minCellY, maxCellY - cy));
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "RoadGraph.h"
+#include "BBox.h"
+#include <qvector2d.h>
+#include <qhash.h>
+#include <vector>
+
+/**
+ * Uniform grid of the polyline segments of the edges for the nearest edge queries.
+ * Each cell has the list of the edges whose polyline passes through the cell.
+ * The valid edges are registered when they are added, validated, or their polylines are changed
+ * (see RoadGraph::enableSegmentIndex). The entries of the invalidated or moved edges are not removed
+ * but skipped by the queries, and the grid is rebuilt when such stale entries increase too much.
+ */
+class SegmentGrid {
+private:
+	float cellSize;
+	QHash<quint64, std::vector<RoadEdgeDesc> > cells;
+	int numEntries;			// the number of the entries including the stale ones
+	int numBuiltEntries;	// the number of the entries right after the last build
+	int minCellX, maxCellX, minCellY, maxCellY;
+	QHash<void*, int> edgeOrders;	// the order of the edges in boost::edges() to break the ties as the linear scan does
+	int numEdgeOrders;
+
+public:
+	SegmentGrid(float cellSize);
+	~SegmentGrid();
+
+	float getCellSize() const;
+	void build(RoadGraph* roads);
+	void clear();
+	void insert(RoadGraph* roads, RoadEdgeDesc e);
+
+	bool findNearest(RoadGraph* roads, const QVector2D& pt, float threshold, RoadVertexDesc ignore, RoadEdgeDesc& e, float& dist, QVector2D& closestPt, bool onlyValidEdge = true) const;
+	std::vector<RoadEdgeDesc> findInRadius(RoadGraph* roads, const QVector2D& pt, float radius, RoadVertexDesc ignore, bool onlyValidEdge = true) const;
+	std::vector<RoadEdgeDesc> findInRect(RoadGraph* roads, const BBox& rect, bool onlyValidEdge = true) const;
+
+private:
+	void addEdge(RoadGraph* roads, RoadEdgeDesc e);
+	int edgeOrder(RoadEdgeDesc e) const;
+	void addCells(const QVector2D& p0, const QVector2D& p1, std::vector<quint64>& keys);
+	bool isCandidate(RoadGraph* roads, RoadEdgeDesc e, RoadVertexDesc ignore, bool onlyValidEdge) const;
+	int toCell(float x) const;
+	static quint64 cellKey(int cx, int cy);
+	int minRing(int cx, int cy) const;
+	int maxRing(int cx, int cy) const;
+};
+
@@ -2,6 +2,11 @@
 #include "GraphUtil.h"
 
 Sketch::Sketch() : RoadGraph() {
+	curVertex = boost::graph_traits<BGLGraph>::null_vertex();
+	curEdge = RoadEdgeDesc();
+
+	// the vertices are searched around the mouse cursor for snapping
+	enableVertexIndex();
 }
 
 Sketch::~Sketch() {
@@ -53,6 +58,32 @@ void Sketch::generateSketchMesh() {
 	}
 }
 
+/**
+ * Remove the invalid vertices and edges from the sketch.
+ * The current vertex and edge are translated to the new descriptors.
+ * If the current vertex is removed, curVertex becomes null_vertex(), and
+ * if the current edge is removed, curEdge becomes RoadEdgeDesc().
+ */
+void Sketch::clean() {
+	RoadVertexDesc null_v = boost::graph_traits<BGLGraph>::null_vertex();
+
+	// the current vertex and edge are tracked separately, since either one can be unset
+	RoadVertexHandle curVertexHandle;
+	RoadEdgeHandle curEdgeHandle;
+	if (curVertex != null_v) curVertexHandle = getHandle(curVertex);
+	if (curEdge != RoadEdgeDesc()) curEdgeHandle = getHandle(curEdge);
+
+	GraphUtil::clean(this);
+
+	if (curVertex != null_v && !resolve(curVertexHandle, curVertex)) curVertex = null_v;
+	if (curEdge != RoadEdgeDesc() && !resolve(curEdgeHandle, curEdge)) curEdge = RoadEdgeDesc();
+
+	// The handles are only needed across the compaction, so their slots are returned to the free list
+	// and reused by the next call. Otherwise, every vertex and edge which has ever been current would keep its slot.
+	if (curVertex != null_v) releaseHandle(curVertex);
+	if (curEdge != RoadEdgeDesc()) releaseHandle(curEdge);
+}
+
 /**
  * Create a road graph from the sketch and return it.
  */
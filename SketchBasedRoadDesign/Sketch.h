@@ -12,6 +12,7 @@ public:
 	~Sketch();
 
 	void generateSketchMesh();
+	void clean();
 	RoadGraph* makeRoads();
 };
 
@@ -1,4 +1,6 @@
 ﻿#include "Util.h"
+#include <limits>
+#include <algorithm>
 
 const float Util::MTC_FLOAT_TOL = 1e-6f;
 
@@ -98,4 +100,78 @@ float Util::pointSegmentDistanceXY(const QVector2D& a, const QVector2D& b, const
 	}
 
 	return abs(dist);
-}
\ No newline at end of file
+}
+
+/**
+ * Compute the distance between the polyline and the point. Store the coordinate of the closest point on the polyline in closestPt.
+ * Unlike pointSegmentDistanceXY, the closest point is clamped to the segments, and the degenerate segments are handled.
+ */
+float Util::pointPolylineDistanceXY(const std::vector<QVector2D>& polyLine, const QVector2D& pt, QVector2D& closestPt) {
+	float min_dist2 = std::numeric_limits<float>::max();
+
+	if (polyLine.size() == 1) {
+		closestPt = polyLine[0];
+		return (polyLine[0] - pt).length();
+	}
+
+	for (int i = 0; i < (int)polyLine.size() - 1; i++) {
+		QVector2D dir = polyLine[i + 1] - polyLine[i];
+		float len2 = dir.lengthSquared();
+
+		float t = 0.0f;
+		if (len2 > 0.0f) {
+			t = QVector2D::dotProduct(pt - polyLine[i], dir) / len2;
+			if (t < 0.0f) t = 0.0f;
+			if (t > 1.0f) t = 1.0f;
+		}
+
+		QVector2D pt2 = polyLine[i] + dir * t;
+		float dist2 = (pt2 - pt).lengthSquared();
+		if (dist2 < min_dist2) {
+			min_dist2 = dist2;
+			closestPt = pt2;
+		}
+	}
+
+	if (min_dist2 == std::numeric_limits<float>::max()) return min_dist2;
+	else return sqrtf(min_dist2);
+}
+
+/**
+ * Compute the convex hull of the points by the monotone chain algorithm in O(n log n).
+ * The vertices of the hull are returned in the counterclockwise order without the collinear points.
+ */
+std::vector<QVector2D> Util::convexHull(const std::vector<QVector2D>& pts) {
+	if (pts.size() <= 1) return pts;
+
+	// sort the points by x, and then by y
+	std::vector<std::pair<float, float> > sorted(pts.size());
+	for (int i = 0; i < pts.size(); i++) {
+		sorted[i] = std::make_pair(pts[i].x(), pts[i].y());
+	}
+	std::sort(sorted.begin(), sorted.end());
+	sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+	if (sorted.size() == 1) return std::vector<QVector2D>(1, QVector2D(sorted[0].first, sorted[0].second));
+
+	std::vector<QVector2D> hull(sorted.size() * 2);
+	int k = 0;
+
+	// lower hull
+	for (int i = 0; i < sorted.size(); i++) {
+		QVector2D p(sorted[i].first, sorted[i].second);
+		while (k >= 2 && (hull[k - 1].x() - hull[k - 2].x()) * (p.y() - hull[k - 2].y()) - (hull[k - 1].y() - hull[k - 2].y()) * (p.x() - hull[k - 2].x()) <= 0) k--;
+		hull[k++] = p;
+	}
+
+	// upper hull
+	for (int i = (int)sorted.size() - 2, lower = k + 1; i >= 0; i--) {
+		QVector2D p(sorted[i].first, sorted[i].second);
+		while (k >= lower && (hull[k - 1].x() - hull[k - 2].x()) * (p.y() - hull[k - 2].y()) - (hull[k - 1].y() - hull[k - 2].y()) * (p.x() - hull[k - 2].x()) <= 0) k--;
+		hull[k++] = p;
+	}
+
+	// the last point is the same as the first one
+	hull.resize(k - 1);
+
+	return hull;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <qvector2d.h>
+#include <vector>
 
 #ifndef M_PI
 #define M_PI	3.14159265
@@ -16,5 +17,7 @@ public:
 
 	static bool segmentSegmentIntersectXY(const QVector2D& a, const QVector2D& b, const QVector2D& c, const QVector2D& d, float *tab, float *tcd, bool segmentOnly, QVector2D &intPoint);
 	static float pointSegmentDistanceXY(const QVector2D& a, const QVector2D& b, const QVector2D& c, QVector2D& closestPtInAB);
+	static float pointPolylineDistanceXY(const std::vector<QVector2D>& polyLine, const QVector2D& pt, QVector2D& closestPt);
+	static std::vector<QVector2D> convexHull(const std::vector<QVector2D>& pts);
 };
 
@@ -0,0 +1,239 @@
+#include "VertexGrid.h"
+#include <limits>
+#include <algorithm>
+#include <math.h>
+
+VertexGrid::VertexGrid(float cellSize) : cellSize(cellSize) {
+	clear();
+}
+
+VertexGrid::~VertexGrid() {
+}
+
+float VertexGrid::getCellSize() const {
+	return cellSize;
+}
+
+/**
+ * Register all the vertices of the road graph from scratch.
+ */
+void VertexGrid::build(RoadGraph* roads) {
+	clear();
+
+	int num = boost::num_vertices(roads->graph);
+	vertexCells.reserve(num);
+	registered.reserve(num);
+
+	RoadVertexIter vi, vend;
+	for (boost::tie(vi, vend) = boost::vertices(roads->graph); vi != vend; ++vi) {
+		insert(*vi, roads->graph[*vi]->pt);
+	}
+}
+
+void VertexGrid::clear() {
+	cells.clear();
+	vertexCells.clear();
+	registered.clear();
+
+	minCellX = std::numeric_limits<int>::max();
+	minCellY = std::numeric_limits<int>::max();
+	maxCellX = std::numeric_limits<int>::min();
+	maxCellY = std::numeric_limits<int>::min();
+}
+
+/**
+ * Register the vertex at the specified position.
+ */
+void VertexGrid::insert(RoadVertexDesc v, const QVector2D& pt) {
+	if (v >= vertexCells.size()) {
+		vertexCells.resize(v + 1, 0);
+		registered.resize(v + 1, false);
+	}
+
+	int cx = toCell(pt.x());
+	int cy = toCell(pt.y());
+	quint64 key = cellKey(cx, cy);
+
+	cells[key].push_back(v);
+	vertexCells[v] = key;
+	registered[v] = true;
+
+	if (cx < minCellX) minCellX = cx;
+	if (cx > maxCellX) maxCellX = cx;
+	if (cy < minCellY) minCellY = cy;
+	if (cy > maxCellY) maxCellY = cy;
+}
+
+/**
+ * Update the cell of the vertex that is moved to the specified position.
+ */
+void VertexGrid::move(RoadVertexDesc v, const QVector2D& pt) {
+	if (v >= registered.size() || !registered[v]) {
+		insert(v, pt);
+		return;
+	}
+
+	quint64 key = cellKey(toCell(pt.x()), toCell(pt.y()));
+	if (key == vertexCells[v]) return;
+
+	std::vector<RoadVertexDesc>& cell = cells[vertexCells[v]];
+	cell.erase(std::find(cell.begin(), cell.end(), v));
+	if (cell.empty()) cells.remove(vertexCells[v]);
+
+	insert(v, pt);
+}
+
+/**
+ * Find the closest vertex within the threshold from the specified point.
+ * The cells are visited ring by ring around the point, and the search stops when no closer vertex can be found in the remaining rings.
+ * If there are more than one vertex at the same distance, the one with the smallest descriptor is returned
+ * so that the result is the same as the linear search.
+ *
+ * @param ignore	the vertex to be ignored (null_vertex() to ignore nothing)
+ * @return			true if the vertex is found. Otherwise, false and desc is not changed.
+ */
+bool VertexGrid::findNearest(RoadGraph* roads, const QVector2D& pt, float threshold, RoadVertexDesc ignore, RoadVertexDesc& desc, bool onlyValidVertex) const {
+	int cx = toCell(pt.x());
+	int cy = toCell(pt.y());
+
+	bool found = false;
+	RoadVertexDesc nearest_desc;
+	float min_dist = threshold;
+
+	int max_r = maxRing(cx, cy);
+	for (int r = minRing(cx, cy); r <= max_r; r++) {
+		// the vertices in this ring are at least (r - 1) * cellSize away from the point
+		if ((r - 1) * cellSize > min_dist) break;
+
+		for (int dy = -r; dy <= r; dy++) {
+			int step = (dy == -r || dy == r) ? 1 : 2 * r;
+			for (int dx = -r; dx <= r; dx += step) {
+				QHash<quint64, std::vector<RoadVertexDesc> >::const_iterator it = cells.constFind(cellKey(cx + dx, cy + dy));
+				if (it == cells.constEnd()) continue;
+
+				const std::vector<RoadVertexDesc>& cell = it.value();
+				for (int i = 0; i < cell.size(); i++) {
+					RoadVertexDesc v = cell[i];
+					if (v == ignore) continue;
+					if (onlyValidVertex && !roads->graph[v]->valid) continue;
+
+					float dist = (roads->graph[v]->pt - pt).length();
+					if (dist > min_dist) continue;
+					if (found && dist == min_dist && v > nearest_desc) continue;
+
+					nearest_desc = v;
+					min_dist = dist;
+					found = true;
+				}
+			}
+		}
+	}
+
+	if (found) desc = nearest_desc;
+
+	return found;
+}
+
+/**
+ * Return all the vertices within the radius from the specified point in the order of the descriptor.
+ */
+std::vector<RoadVertexDesc> VertexGrid::findInRadius(RoadGraph* roads, const QVector2D& pt, float radius, bool onlyValidVertex) const {
+	std::vector<RoadVertexDesc> ret;
+
+	int cx0 = std::max(toCell(pt.x() - radius), minCellX);
+	int cx1 = std::min(toCell(pt.x() + radius), maxCellX);
+	int cy0 = std::max(toCell(pt.y() - radius), minCellY);
+	int cy1 = std::min(toCell(pt.y() + radius), maxCellY);
+
+	for (int cy = cy0; cy <= cy1; cy++) {
+		for (int cx = cx0; cx <= cx1; cx++) {
+			QHash<quint64, std::vector<RoadVertexDesc> >::const_iterator it = cells.constFind(cellKey(cx, cy));
+			if (it == cells.constEnd()) continue;
+
+			const std::vector<RoadVertexDesc>& cell = it.value();
+			for (int i = 0; i < cell.size(); i++) {
+				RoadVertexDesc v = cell[i];
+				if (onlyValidVertex && !roads->graph[v]->valid) continue;
+
+				if ((roads->graph[v]->pt - pt).length() <= radius) ret.push_back(v);
+			}
+		}
+	}
+
+	std::sort(ret.begin(), ret.end());
+
+	return ret;
+}
+
+/**
+ * Return the k closest vertices from the specified point in the order of the distance.
+ * If the graph has less than k vertices, all the vertices are returned.
+ */
+std::vector<RoadVertexDesc> VertexGrid::findNearestK(RoadGraph* roads, const QVector2D& pt, int k, bool onlyValidVertex) const {
+	std::vector<std::pair<float, RoadVertexDesc> > candidates;
+	if (k <= 0) return std::vector<RoadVertexDesc>();
+
+	int cx = toCell(pt.x());
+	int cy = toCell(pt.y());
+
+	int max_r = maxRing(cx, cy);
+	for (int r = minRing(cx, cy); r <= max_r; r++) {
+		// the k-th closest vertex found so far is closer than any vertex in the remaining rings
+		if (candidates.size() >= k && (r - 1) * cellSize > candidates[k - 1].first) break;
+
+		for (int dy = -r; dy <= r; dy++) {
+			int step = (dy == -r || dy == r) ? 1 : 2 * r;
+			for (int dx = -r; dx <= r; dx += step) {
+				QHash<quint64, std::vector<RoadVertexDesc> >::const_iterator it = cells.constFind(cellKey(cx + dx, cy + dy));
+				if (it == cells.constEnd()) continue;
+
+				const std::vector<RoadVertexDesc>& cell = it.value();
+				for (int i = 0; i < cell.size(); i++) {
+					RoadVertexDesc v = cell[i];
+					if (onlyValidVertex && !roads->graph[v]->valid) continue;
+
+					candidates.push_back(std::make_pair((roads->graph[v]->pt - pt).length(), v));
+				}
+			}
+		}
+
+		std::sort(candidates.begin(), candidates.end());
+		if (candidates.size() > k) candidates.resize(k);
+	}
+
+	std::vector<RoadVertexDesc> ret;
+	for (int i = 0; i < candidates.size(); i++) {
+		ret.push_back(candidates[i].second);
+	}
+
+	return ret;
+}
+
+int VertexGrid::toCell(float x) const {
+	return (int)floor(x / cellSize);
+}
+
+quint64 VertexGrid::cellKey(int cx, int cy) {
+	return ((quint64)(unsigned int)cx << 32) | (quint64)(unsigned int)cy;
+}
+
+/**
+ * Return the first ring around the cell that overlaps with the registered cells.
+ */
+int VertexGrid::minRing(int cx, int cy) const {
+	if (minCellX > maxCellX) return 0;
+
+	int dx = std::max(std::max(minCellX - cx, cx - maxCellX), 0);
+	int dy = std::max(std::max(minCellY - cy, cy - maxCellY), 0);
+
+	return std::max(dx, dy);
+}
+
+/**
+ * Return the number of rings around the cell that cover all the registered vertices (-1 if the grid is empty).
+ */
+int VertexGrid::maxRing(int cx, int cy) const {
+	if (minCellX > maxCellX) return -1;
+
+	return std::max(std::max(cx - minCellX, maxCellX - cx), std::max(cy - minCellY, maxCellY - cy));
+}
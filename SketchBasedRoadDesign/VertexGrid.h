@@ -0,0 +1,42 @@
+#pragma once
+
+#include "RoadGraph.h"
+#include <qvector2d.h>
+#include <qhash.h>
+#include <vector>
+
+/**
+ * Uniform grid of the vertex positions for the proximity queries.
+ * All the vertices are registered including the invalid ones, and the queries check the valid flag.
+ * The grid is owned by RoadGraph (see RoadGraph::enableVertexIndex), which keeps it up to date
+ * when a vertex is added or moved by RoadGraph::setPt.
+ */
+class VertexGrid {
+private:
+	float cellSize;
+	QHash<quint64, std::vector<RoadVertexDesc> > cells;
+	std::vector<quint64> vertexCells;		// the cell of each vertex
+	std::vector<bool> registered;			// true if the vertex is registered in the grid
+	int minCellX, maxCellX, minCellY, maxCellY;
+
+public:
+	VertexGrid(float cellSize);
+	~VertexGrid();
+
+	float getCellSize() const;
+	void build(RoadGraph* roads);
+	void clear();
+	void insert(RoadVertexDesc v, const QVector2D& pt);
+	void move(RoadVertexDesc v, const QVector2D& pt);
+
+	bool findNearest(RoadGraph* roads, const QVector2D& pt, float threshold, RoadVertexDesc ignore, RoadVertexDesc& desc, bool onlyValidVertex = true) const;
+	std::vector<RoadVertexDesc> findInRadius(RoadGraph* roads, const QVector2D& pt, float radius, bool onlyValidVertex = true) const;
+	std::vector<RoadVertexDesc> findNearestK(RoadGraph* roads, const QVector2D& pt, int k, bool onlyValidVertex = true) const;
+
+private:
+	int toCell(float x) const;
+	static quint64 cellKey(int cx, int cy);
+	int minRing(int cx, int cy) const;
+	int maxRing(int cx, int cy) const;
+};
+